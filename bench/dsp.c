@@ -0,0 +1,113 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "dsp.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const int rate = 44100;
+static const int hop_size = 44100/60;
+static const double duration = 0.5; // seconds per frequency step
+
+#define MAX_STREAMS 4
+
+static double get_time(void) {
+	struct timespec timestamp;
+	clock_gettime(CLOCK_MONOTONIC, &timestamp);
+	return timestamp.tv_sec + timestamp.tv_nsec/1e9;
+}
+
+static bool run(const float *hop, int frequency_step, int bins, bool decimate) {
+	struct wav_dsp dsp;
+	struct wav_peaks peaks;
+	if (!init_dsp(&dsp, rate, frequency_step, bins, 1, decimate, FFTW_MEASURE) ||
+			!init_peaks(&peaks, bins, 0.5, false)) return false;
+
+	long hops = 0;
+	double start = get_time(), elapsed;
+	do {
+		for (int i = 0; i < 64; ++i) {
+			push_dsp_samples(&dsp, 0, hop, hop_size);
+			if (!is_dsp_silent(&dsp, 0)) run_dsp(&dsp);
+			update_peaks(&peaks, dsp.spectrum, get_dsp_time());
+		}
+		hops += 64;
+		elapsed = get_time() - start;
+	} while (elapsed < duration);
+
+	printf("frequency_step=%d decimation=%d fft_size=%d bins=%d hops/s=%.0f ns/bin=%.2f\n",
+			frequency_step, dsp.decimation, dsp.buf_size, bins, hops/elapsed, elapsed*1e9/hops/bins);
+	finish_peaks(&peaks);
+	finish_dsp(&dsp);
+	return true;
+}
+
+// several sources through the one batched transform, against as many transforms of their own,
+// which is what running another instance for each would cost
+static bool run_sources(const float *hop, int frequency_step, int bins, int source_count) {
+	struct wav_dsp batched, separate[MAX_STREAMS];
+	if (!init_dsp(&batched, rate, frequency_step, bins, source_count, false, FFTW_MEASURE)) return false;
+	for (int s = 0; s < source_count; ++s) {
+		if (!init_dsp(&separate[s], rate, frequency_step, bins, 1, false, FFTW_MEASURE)) return false;
+	}
+
+	long hops = 0;
+	double start = get_time(), batched_time;
+	do {
+		for (int i = 0; i < 64; ++i) {
+			for (int s = 0; s < source_count; ++s) push_dsp_samples(&batched, s, hop, hop_size);
+			run_dsp(&batched);
+		}
+		hops += 64;
+		batched_time = get_time() - start;
+	} while (batched_time < duration);
+	batched_time /= hops;
+
+	hops = 0;
+	double separate_time;
+	start = get_time();
+	do {
+		for (int i = 0; i < 64; ++i) {
+			for (int s = 0; s < source_count; ++s) {
+				push_dsp_samples(&separate[s], 0, hop, hop_size);
+				run_dsp(&separate[s]);
+			}
+		}
+		hops += 64;
+		separate_time = get_time() - start;
+	} while (separate_time < duration);
+	separate_time /= hops;
+
+	printf("frequency_step=%d fft_size=%d bins=%d sources=%d batched_us/hop=%.2f separate_us/hop=%.2f\n",
+			frequency_step, batched.buf_size, bins, source_count, batched_time*1e6, separate_time*1e6);
+	for (int s = 0; s < source_count; ++s) finish_dsp(&separate[s]);
+	finish_dsp(&batched);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	static const int frequency_steps[] = { 5, 10, 20, 40, 80 };
+
+	float *hop = malloc(hop_size*sizeof(*hop));
+	if (hop == NULL) return EXIT_FAILURE;
+	srand(1);
+	for (int i = 0; i < hop_size; ++i) hop[i] = 2.0f*rand()/RAND_MAX - 1;
+
+	// every bin, then only the bottom eighth of them as on a typical output, with and without decimation
+	for (size_t s = 0; s < sizeof(frequency_steps)/sizeof(*frequency_steps); ++s) {
+		int frequency_step = frequency_steps[s];
+		int bins = rate/frequency_step/2 - 1;
+		if (!run(hop, frequency_step, bins, false) ||
+				!run(hop, frequency_step, bins/8, false) ||
+				!run(hop, frequency_step, bins/8, true)) return EXIT_FAILURE;
+	}
+
+	for (int source_count = 1; source_count <= MAX_STREAMS; ++source_count) {
+		if (!run_sources(hop, 10, 512, source_count)) return EXIT_FAILURE;
+	}
+
+	free(hop);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,746 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "mock-compositor.h"
+
+#include "wlr-layer-shell-unstable-v1-server-protocol.h"
+#include "xdg-output-unstable-v1-server-protocol.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server.h>
+
+#define MAX_MESSAGE_COUNTS 64
+
+enum mock_command_type {
+	MOCK_QUIT,
+	MOCK_TIMING,
+	MOCK_ADD_OUTPUT,
+	MOCK_REMOVE_OUTPUT
+};
+
+struct mock_command {
+	enum mock_command_type type;
+	int output;
+	int64_t refresh;
+	int release_delay;
+};
+
+struct mock_output {
+	struct mock_compositor *compositor;
+	int index;
+	struct wl_global *global; // NULL while unplugged
+	struct wl_global *removed_global; // withdrawn, but not destroyed until plugged in again
+	unsigned generation; // plugged in this many times
+	atomic_ulong commits; // since last plugged in
+};
+
+struct mock_buffer {
+	struct mock_compositor *compositor;
+	struct wl_resource *resource;
+	struct wl_list link; // mock_compositor::replaced_buffers once replaced, until released
+	int64_t release_time;
+};
+
+struct mock_surface {
+	struct mock_compositor *compositor;
+	struct wl_resource *resource;
+	struct wl_list link; // mock_compositor::surfaces
+
+	struct wl_resource *layer_surface; // NULL until the surface is given the role
+	struct wl_resource *output_resource; // the layer surface was put on
+	struct wl_listener output_destroy;
+	unsigned generation; // of the output when the layer surface was put on it
+	bool configured;
+	bool entered;
+
+	bool attached; // since the last commit
+	struct mock_buffer *pending_buffer;
+	struct mock_buffer *buffer; // committed
+	struct wl_list pending_callbacks; // frame callbacks requested since the last commit
+	struct wl_list callbacks; // committed, answered on the next refresh
+};
+
+struct mock_compositor {
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	pthread_t thread;
+	bool running;
+
+	// commands are handled on the compositor's own thread, and each is acknowledged once done
+	int commandfd[2];
+	int ackfd[2];
+	int refreshfd; // timerfd
+	struct wl_event_source *command_source;
+	struct wl_event_source *refresh_source;
+	struct wl_event_source *release_timer;
+
+	int width;
+	int height;
+	int64_t refresh;
+	int release_delay;
+	uint32_t serial;
+
+	struct mock_output outputs[MOCK_MAX_OUTPUTS];
+	bool plugged[MOCK_MAX_OUTPUTS]; // only touched by the client's thread
+	struct wl_list surfaces; // mock_surface::link
+	struct wl_list replaced_buffers; // mock_buffer::link, oldest first
+
+	atomic_ulong commits;
+	atomic_ulong frames;
+	atomic_ulong releases;
+	atomic_ulong requests;
+	atomic_ulong events;
+
+	pthread_mutex_t lock; // over the message counts
+	struct mock_message_count messages[MAX_MESSAGE_COUNTS];
+	int message_count;
+};
+
+static void noop() {
+	// intentionally left blank
+}
+
+static int64_t get_time(void) {
+	struct timespec timestamp;
+	clock_gettime(CLOCK_MONOTONIC, &timestamp);
+	return 1000000000*(int64_t) timestamp.tv_sec + timestamp.tv_nsec;
+}
+
+static void destroy_resource(struct wl_client *client, struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void release_buffer(struct mock_buffer *buffer) {
+	wl_list_remove(&buffer->link);
+	wl_list_init(&buffer->link);
+	wl_buffer_send_release(buffer->resource);
+	atomic_fetch_add_explicit(&buffer->compositor->releases, 1, memory_order_relaxed);
+}
+
+static int release_replaced_buffers(void *data) {
+	struct mock_compositor *compositor = data;
+	int64_t now = get_time();
+	struct mock_buffer *buffer, *tmp;
+	wl_list_for_each_safe(buffer, tmp, &compositor->replaced_buffers, link) {
+		if (buffer->release_time > now) {
+			wl_event_source_timer_update(compositor->release_timer, (buffer->release_time - now + 999999)/1000000);
+			break;
+		}
+		release_buffer(buffer);
+	}
+	return 0;
+}
+
+// as a compositor that holds on to a buffer for a while after it has been replaced, as when still reading it
+static void replace_buffer(struct mock_compositor *compositor, struct mock_buffer *buffer) {
+	if (compositor->release_delay == 0) {
+		release_buffer(buffer);
+		return;
+	}
+
+	buffer->release_time = get_time() + 1000000*(int64_t) compositor->release_delay;
+	if (wl_list_empty(&compositor->replaced_buffers)) {
+		wl_event_source_timer_update(compositor->release_timer, compositor->release_delay);
+	}
+	wl_list_insert(compositor->replaced_buffers.prev, &buffer->link);
+}
+
+static void destroy_buffer(struct wl_resource *resource) {
+	struct mock_buffer *buffer = wl_resource_get_user_data(resource);
+	struct mock_surface *surface;
+	wl_list_for_each(surface, &buffer->compositor->surfaces, link) {
+		if (surface->pending_buffer == buffer) surface->pending_buffer = NULL;
+		if (surface->buffer == buffer) surface->buffer = NULL;
+	}
+	wl_list_remove(&buffer->link);
+	free(buffer);
+}
+
+static void create_buffer(struct wl_client *client, struct wl_resource *resource, uint32_t id,
+		int32_t offset, int32_t width, int32_t height, int32_t stride, uint32_t format) {
+	struct mock_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	buffer->compositor = wl_resource_get_user_data(resource);
+	wl_list_init(&buffer->link);
+
+	buffer->resource = wl_resource_create(client, &wl_buffer_interface, 1, id);
+	if (buffer->resource == NULL) {
+		free(buffer);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	static const struct wl_buffer_interface buffer_implementation = {
+		.destroy = destroy_resource
+	};
+	wl_resource_set_implementation(buffer->resource, &buffer_implementation, buffer, destroy_buffer);
+}
+
+static void create_pool(struct wl_client *client, struct wl_resource *resource, uint32_t id, int32_t fd, int32_t size) {
+	// the pixels are never looked at
+	close(fd);
+
+	struct wl_resource *pool = wl_resource_create(client, &wl_shm_pool_interface, 1, id);
+	if (pool == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	static const struct wl_shm_pool_interface pool_implementation = {
+		.create_buffer = create_buffer,
+		.destroy = destroy_resource,
+		.resize = noop
+	};
+	wl_resource_set_implementation(pool, &pool_implementation, wl_resource_get_user_data(resource), NULL);
+}
+
+static void bind_shm(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client, &wl_shm_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	static const struct wl_shm_interface shm_implementation = {
+		.create_pool = create_pool
+	};
+	wl_resource_set_implementation(resource, &shm_implementation, data, NULL);
+	wl_shm_send_format(resource, WL_SHM_FORMAT_ARGB8888);
+	wl_shm_send_format(resource, WL_SHM_FORMAT_XRGB8888);
+}
+
+static void unlink_callback(struct wl_resource *callback) {
+	wl_list_remove(wl_resource_get_link(callback));
+}
+
+static void answer_callbacks(struct mock_surface *surface, uint32_t time) {
+	struct wl_resource *callback, *tmp;
+	wl_resource_for_each_safe(callback, tmp, &surface->callbacks) {
+		wl_callback_send_done(callback, time);
+		wl_resource_destroy(callback);
+		atomic_fetch_add_explicit(&surface->compositor->frames, 1, memory_order_relaxed);
+	}
+}
+
+static void request_frame(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	struct wl_resource *callback = wl_resource_create(client, &wl_callback_interface, 1, id);
+	if (callback == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(callback, NULL, NULL, unlink_callback);
+	wl_list_insert(surface->pending_callbacks.prev, wl_resource_get_link(callback));
+}
+
+static void attach_surface(struct wl_client *client, struct wl_resource *resource,
+		struct wl_resource *buffer, int32_t x, int32_t y) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	surface->attached = true;
+	surface->pending_buffer = buffer != NULL ? wl_resource_get_user_data(buffer) : NULL;
+}
+
+static void commit_surface(struct wl_client *client, struct wl_resource *resource) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	struct mock_compositor *compositor = surface->compositor;
+
+	if (surface->attached) {
+		struct mock_buffer *buffer = surface->pending_buffer;
+		if (surface->buffer != NULL && surface->buffer != buffer) replace_buffer(compositor, surface->buffer);
+		if (buffer != NULL) {
+			// reattached before it was released
+			wl_list_remove(&buffer->link);
+			wl_list_init(&buffer->link);
+		}
+		surface->buffer = buffer;
+		surface->pending_buffer = NULL;
+		surface->attached = false;
+
+		if (buffer != NULL) {
+			atomic_fetch_add_explicit(&compositor->commits, 1, memory_order_relaxed);
+			if (surface->output_resource != NULL) {
+				// a surface left over from before the output was last plugged in does not count
+				struct mock_output *output = wl_resource_get_user_data(surface->output_resource);
+				if (surface->generation == output->generation) {
+					atomic_fetch_add_explicit(&output->commits, 1, memory_order_relaxed);
+				}
+				if (!surface->entered) wl_surface_send_enter(surface->resource, surface->output_resource);
+				surface->entered = true;
+			}
+		}
+	}
+
+	wl_list_insert_list(surface->callbacks.prev, &surface->pending_callbacks);
+	wl_list_init(&surface->pending_callbacks);
+
+	// the initial commit, which a layer surface is configured in response to
+	if (surface->layer_surface != NULL && !surface->configured) {
+		zwlr_layer_surface_v1_send_configure(surface->layer_surface, ++compositor->serial,
+				compositor->width, compositor->height);
+		surface->configured = true;
+	}
+
+	if (compositor->refresh == 0) answer_callbacks(surface, get_time()/1000000);
+}
+
+static void destroy_surface(struct wl_resource *resource) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	if (surface->layer_surface != NULL) wl_resource_set_user_data(surface->layer_surface, NULL);
+	wl_list_remove(&surface->output_destroy.link);
+
+	// the callbacks belong to the client, and are only forgotten
+	struct wl_resource *callback, *tmp;
+	wl_resource_for_each_safe(callback, tmp, &surface->pending_callbacks) {
+		wl_list_remove(wl_resource_get_link(callback));
+		wl_list_init(wl_resource_get_link(callback));
+	}
+	wl_resource_for_each_safe(callback, tmp, &surface->callbacks) {
+		wl_list_remove(wl_resource_get_link(callback));
+		wl_list_init(wl_resource_get_link(callback));
+	}
+
+	wl_list_remove(&surface->link);
+	free(surface);
+}
+
+static void create_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+	struct mock_surface *surface = calloc(1, sizeof(*surface));
+	if (surface == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	surface->compositor = wl_resource_get_user_data(resource);
+	wl_list_init(&surface->output_destroy.link);
+	wl_list_init(&surface->pending_callbacks);
+	wl_list_init(&surface->callbacks);
+
+	surface->resource = wl_resource_create(client, &wl_surface_interface, wl_resource_get_version(resource), id);
+	if (surface->resource == NULL) {
+		free(surface);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	static const struct wl_surface_interface surface_implementation = {
+		.destroy = destroy_resource,
+		.attach = attach_surface,
+		.damage = noop,
+		.frame = request_frame,
+		.set_opaque_region = noop,
+		.set_input_region = noop,
+		.commit = commit_surface,
+		.set_buffer_transform = noop,
+		.set_buffer_scale = noop,
+		.damage_buffer = noop
+	};
+	wl_resource_set_implementation(surface->resource, &surface_implementation, surface, destroy_surface);
+	wl_list_insert(&surface->compositor->surfaces, &surface->link);
+}
+
+static void create_region(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+	struct wl_resource *region = wl_resource_create(client, &wl_region_interface, 1, id);
+	if (region == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	static const struct wl_region_interface region_implementation = {
+		.destroy = destroy_resource,
+		.add = noop,
+		.subtract = noop
+	};
+	wl_resource_set_implementation(region, &region_implementation, NULL, NULL);
+}
+
+static void bind_compositor(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client, &wl_compositor_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	static const struct wl_compositor_interface compositor_implementation = {
+		.create_surface = create_surface,
+		.create_region = create_region
+	};
+	wl_resource_set_implementation(resource, &compositor_implementation, data, NULL);
+}
+
+static void bind_output(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+	struct mock_output *output = data;
+	struct mock_compositor *compositor = output->compositor;
+	struct wl_resource *resource = wl_resource_create(client, &wl_output_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	static const struct wl_output_interface output_implementation = {
+		.release = destroy_resource
+	};
+	wl_resource_set_implementation(resource, &output_implementation, output, NULL);
+
+	int32_t refresh = compositor->refresh > 0 ? 1000000000000/compositor->refresh : 0; // in mHz
+	wl_output_send_geometry(resource, 0, 0, 600, 340, WL_OUTPUT_SUBPIXEL_UNKNOWN,
+			"wav", "mock", WL_OUTPUT_TRANSFORM_NORMAL);
+	wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT, compositor->width, compositor->height, refresh);
+	if (version >= WL_OUTPUT_SCALE_SINCE_VERSION) wl_output_send_scale(resource, 1);
+	if (version >= WL_OUTPUT_DONE_SINCE_VERSION) wl_output_send_done(resource);
+}
+
+static void get_xdg_output(struct wl_client *client, struct wl_resource *resource, uint32_t id,
+		struct wl_resource *output_resource) {
+	struct mock_output *output = wl_resource_get_user_data(output_resource);
+	struct mock_compositor *compositor = output->compositor;
+	int version = wl_resource_get_version(resource);
+	struct wl_resource *xdg_output = wl_resource_create(client, &zxdg_output_v1_interface, version, id);
+	if (xdg_output == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	static const struct zxdg_output_v1_interface xdg_output_implementation = {
+		.destroy = destroy_resource
+	};
+	wl_resource_set_implementation(xdg_output, &xdg_output_implementation, output, NULL);
+
+	zxdg_output_v1_send_logical_position(xdg_output, 0, 0);
+	zxdg_output_v1_send_logical_size(xdg_output, compositor->width, compositor->height);
+	if (version >= ZXDG_OUTPUT_V1_NAME_SINCE_VERSION) {
+		char name[16];
+		snprintf(name, sizeof(name), "MOCK-%d", output->index);
+		zxdg_output_v1_send_name(xdg_output, name);
+		zxdg_output_v1_send_description(xdg_output, "Mock output");
+	}
+	if (version < 3) zxdg_output_v1_send_done(xdg_output);
+	if (wl_resource_get_version(output_resource) >= WL_OUTPUT_DONE_SINCE_VERSION) wl_output_send_done(output_resource);
+}
+
+static void bind_output_manager(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client, &zxdg_output_manager_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	static const struct zxdg_output_manager_v1_interface output_manager_implementation = {
+		.destroy = destroy_resource,
+		.get_xdg_output = get_xdg_output
+	};
+	wl_resource_set_implementation(resource, &output_manager_implementation, data, NULL);
+}
+
+static void unlink_layer_surface(struct wl_resource *resource) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	if (surface != NULL) surface->layer_surface = NULL;
+}
+
+static void handle_output_destroy(struct wl_listener *listener, void *data) {
+	struct mock_surface *surface = wl_container_of(listener, surface, output_destroy);
+	wl_list_remove(&listener->link);
+	wl_list_init(&listener->link);
+	surface->output_resource = NULL;
+}
+
+static void get_layer_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource, struct wl_resource *output_resource, uint32_t layer,
+		const char *namespace) {
+	struct mock_surface *surface = wl_resource_get_user_data(surface_resource);
+	struct wl_resource *layer_surface = wl_resource_create(client, &zwlr_layer_surface_v1_interface,
+			wl_resource_get_version(resource), id);
+	if (layer_surface == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	static const struct zwlr_layer_surface_v1_interface layer_surface_implementation = {
+		.set_size = noop,
+		.set_anchor = noop,
+		.set_exclusive_zone = noop,
+		.set_margin = noop,
+		.set_keyboard_interactivity = noop,
+		.get_popup = noop,
+		.ack_configure = noop,
+		.destroy = destroy_resource,
+		.set_layer = noop
+	};
+	wl_resource_set_implementation(layer_surface, &layer_surface_implementation, surface, unlink_layer_surface);
+	surface->layer_surface = layer_surface;
+
+	if (output_resource != NULL) {
+		surface->output_resource = output_resource;
+		surface->generation = ((struct mock_output *) wl_resource_get_user_data(output_resource))->generation;
+		surface->output_destroy.notify = handle_output_destroy;
+		wl_resource_add_destroy_listener(output_resource, &surface->output_destroy);
+	}
+}
+
+static void bind_layer_shell(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client, &zwlr_layer_shell_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	static const struct zwlr_layer_shell_v1_interface layer_shell_implementation = {
+		.get_layer_surface = get_layer_surface,
+		.destroy = destroy_resource
+	};
+	wl_resource_set_implementation(resource, &layer_shell_implementation, data, NULL);
+}
+
+static void log_message(void *data, enum wl_protocol_logger_type type, const struct wl_protocol_logger_message *message) {
+	struct mock_compositor *compositor = data;
+	bool request = type == WL_PROTOCOL_LOGGER_REQUEST;
+	atomic_fetch_add_explicit(request ? &compositor->requests : &compositor->events, 1, memory_order_relaxed);
+
+	char name[sizeof(compositor->messages[0].name)];
+	snprintf(name, sizeof(name), "%s.%s", wl_resource_get_class(message->resource), message->message->name);
+
+	pthread_mutex_lock(&compositor->lock);
+	int i = 0;
+	while (i < compositor->message_count &&
+			(compositor->messages[i].request != request || strcmp(compositor->messages[i].name, name) != 0)) {
+		++i;
+	}
+	if (i == compositor->message_count && i < MAX_MESSAGE_COUNTS) {
+		strcpy(compositor->messages[i].name, name);
+		compositor->messages[i].request = request;
+		compositor->messages[i].count = 0;
+		++compositor->message_count;
+	}
+	if (i < MAX_MESSAGE_COUNTS) ++compositor->messages[i].count;
+	pthread_mutex_unlock(&compositor->lock);
+}
+
+static int answer_refresh(int fd, uint32_t mask, void *data) {
+	struct mock_compositor *compositor = data;
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) < 0) return 0;
+
+	uint32_t time = get_time()/1000000;
+	struct mock_surface *surface;
+	wl_list_for_each(surface, &compositor->surfaces, link) answer_callbacks(surface, time);
+	return 0;
+}
+
+static void set_timing(struct mock_compositor *compositor, int64_t refresh, int release_delay) {
+	compositor->refresh = refresh;
+	compositor->release_delay = release_delay;
+
+	struct timespec period = {
+		.tv_sec = refresh/1000000000,
+		.tv_nsec = refresh%1000000000
+	};
+	struct itimerspec spec = {
+		.it_interval = period,
+		.it_value = period
+	};
+	timerfd_settime(compositor->refreshfd, 0, &spec, NULL);
+
+	// anything still waiting would otherwise never be answered
+	if (refresh == 0) {
+		struct mock_surface *surface;
+		wl_list_for_each(surface, &compositor->surfaces, link) answer_callbacks(surface, get_time()/1000000);
+	}
+	release_replaced_buffers(compositor);
+}
+
+static int handle_command(int fd, uint32_t mask, void *data) {
+	struct mock_compositor *compositor = data;
+	struct mock_command command;
+	if (read(fd, &command, sizeof(command)) != sizeof(command)) return 0;
+
+	struct mock_output *output = &compositor->outputs[command.output];
+	switch (command.type) {
+		case MOCK_QUIT:
+			compositor->running = false;
+			break;
+		case MOCK_TIMING:
+			set_timing(compositor, command.refresh, command.release_delay);
+			break;
+		case MOCK_ADD_OUTPUT:
+			if (output->removed_global != NULL) wl_global_destroy(output->removed_global);
+			output->removed_global = NULL;
+			++output->generation;
+			atomic_store(&output->commits, 0);
+			output->global = wl_global_create(compositor->display, &wl_output_interface, 3, output, bind_output);
+			break;
+		case MOCK_REMOVE_OUTPUT:
+			// the client may already be binding it, which must not fail
+			wl_global_remove(output->global);
+			output->removed_global = output->global;
+			output->global = NULL;
+			break;
+	}
+
+	static const char ack = 0;
+	write(compositor->ackfd[1], &ack, sizeof(ack));
+	return 0;
+}
+
+static void send_command(struct mock_compositor *compositor, const struct mock_command *command) {
+	char ack;
+	write(compositor->commandfd[1], command, sizeof(*command));
+	read(compositor->ackfd[0], &ack, sizeof(ack));
+}
+
+static void *run_mock_compositor(void *data) {
+	struct mock_compositor *compositor = data;
+	while (compositor->running) {
+		wl_display_flush_clients(compositor->display);
+		wl_event_loop_dispatch(compositor->loop, -1);
+	}
+	return NULL;
+}
+
+struct mock_compositor *start_mock_compositor(int width, int height) {
+	struct mock_compositor *compositor = calloc(1, sizeof(*compositor));
+	if (compositor == NULL) {
+		fputs("Failed to allocate memory for compositor\n", stderr);
+		return NULL;
+	}
+	compositor->width = width;
+	compositor->height = height;
+	compositor->running = true;
+	wl_list_init(&compositor->surfaces);
+	wl_list_init(&compositor->replaced_buffers);
+	pthread_mutex_init(&compositor->lock, NULL);
+	for (int i = 0; i < MOCK_MAX_OUTPUTS; ++i) {
+		compositor->outputs[i].compositor = compositor;
+		compositor->outputs[i].index = i;
+	}
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1 ||
+			pipe(compositor->commandfd) == -1 || pipe(compositor->ackfd) == -1) {
+		fputs("Failed to create compositor sockets\n", stderr);
+		return NULL;
+	}
+	compositor->refreshfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+	compositor->display = wl_display_create();
+	if (compositor->display == NULL || compositor->refreshfd == -1) {
+		fputs("Failed to create compositor\n", stderr);
+		return NULL;
+	}
+	compositor->loop = wl_display_get_event_loop(compositor->display);
+	wl_display_add_protocol_logger(compositor->display, log_message, compositor);
+
+	wl_global_create(compositor->display, &wl_compositor_interface, 4, compositor, bind_compositor);
+	wl_global_create(compositor->display, &wl_shm_interface, 1, compositor, bind_shm);
+	wl_global_create(compositor->display, &zxdg_output_manager_v1_interface, 3, compositor, bind_output_manager);
+	wl_global_create(compositor->display, &zwlr_layer_shell_v1_interface, 4, compositor, bind_layer_shell);
+	compositor->outputs[0].global = wl_global_create(compositor->display, &wl_output_interface, 3,
+			&compositor->outputs[0], bind_output);
+	compositor->plugged[0] = true;
+
+	compositor->command_source = wl_event_loop_add_fd(compositor->loop, compositor->commandfd[0],
+			WL_EVENT_READABLE, handle_command, compositor);
+	compositor->refresh_source = wl_event_loop_add_fd(compositor->loop, compositor->refreshfd,
+			WL_EVENT_READABLE, answer_refresh, compositor);
+	compositor->release_timer = wl_event_loop_add_timer(compositor->loop, release_replaced_buffers, compositor);
+
+	// the client end is found by wl_display_connect() through the environment
+	if (wl_client_create(compositor->display, fds[0]) == NULL) {
+		fputs("Failed to create compositor client\n", stderr);
+		return NULL;
+	}
+	char socket[16];
+	snprintf(socket, sizeof(socket), "%d", fds[1]);
+	setenv("WAYLAND_SOCKET", socket, true);
+
+	if (pthread_create(&compositor->thread, NULL, run_mock_compositor, compositor) != 0) {
+		fputs("Failed to start compositor thread\n", stderr);
+		return NULL;
+	}
+	return compositor;
+}
+
+void stop_mock_compositor(struct mock_compositor *compositor) {
+	struct mock_command command = { .type = MOCK_QUIT };
+	send_command(compositor, &command);
+	pthread_join(compositor->thread, NULL);
+
+	wl_event_source_remove(compositor->command_source);
+	wl_event_source_remove(compositor->refresh_source);
+	wl_event_source_remove(compositor->release_timer);
+	wl_display_destroy(compositor->display);
+
+	close(compositor->refreshfd);
+	for (int i = 0; i < 2; ++i) {
+		close(compositor->commandfd[i]);
+		close(compositor->ackfd[i]);
+	}
+	pthread_mutex_destroy(&compositor->lock);
+	free(compositor);
+}
+
+void set_mock_timing(struct mock_compositor *compositor, int64_t refresh, int release_delay) {
+	struct mock_command command = {
+		.type = MOCK_TIMING,
+		.refresh = refresh,
+		.release_delay = release_delay
+	};
+	send_command(compositor, &command);
+}
+
+int add_mock_output(struct mock_compositor *compositor) {
+	int output = 0;
+	while (output < MOCK_MAX_OUTPUTS && compositor->plugged[output]) ++output;
+	if (output == MOCK_MAX_OUTPUTS) return -1;
+
+	compositor->plugged[output] = true;
+	struct mock_command command = {
+		.type = MOCK_ADD_OUTPUT,
+		.output = output
+	};
+	send_command(compositor, &command);
+	return output;
+}
+
+void remove_mock_output(struct mock_compositor *compositor, int output) {
+	if (!compositor->plugged[output]) return;
+
+	compositor->plugged[output] = false;
+	struct mock_command command = {
+		.type = MOCK_REMOVE_OUTPUT,
+		.output = output
+	};
+	send_command(compositor, &command);
+}
+
+unsigned long get_mock_output_commits(struct mock_compositor *compositor, int output) {
+	return atomic_load(&compositor->outputs[output].commits);
+}
+
+struct mock_stats get_mock_stats(struct mock_compositor *compositor) {
+	return (struct mock_stats) {
+		.commits = atomic_load(&compositor->commits),
+		.frames = atomic_load(&compositor->frames),
+		.releases = atomic_load(&compositor->releases),
+		.requests = atomic_load(&compositor->requests),
+		.events = atomic_load(&compositor->events)
+	};
+}
+
+int get_mock_messages(struct mock_compositor *compositor, struct mock_message_count *counts, int size) {
+	pthread_mutex_lock(&compositor->lock);
+	int count = compositor->message_count;
+	memcpy(counts, compositor->messages, (count < size ? count : size)*sizeof(*counts));
+	pthread_mutex_unlock(&compositor->lock);
+	return count;
+}
+
+void reset_mock_stats(struct mock_compositor *compositor) {
+	atomic_store(&compositor->commits, 0);
+	atomic_store(&compositor->frames, 0);
+	atomic_store(&compositor->releases, 0);
+	atomic_store(&compositor->requests, 0);
+	atomic_store(&compositor->events, 0);
+
+	pthread_mutex_lock(&compositor->lock);
+	compositor->message_count = 0;
+	pthread_mutex_unlock(&compositor->lock);
+}
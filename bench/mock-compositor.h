@@ -0,0 +1,47 @@
+#ifndef _MOCK_COMPOSITOR_H
+#define _MOCK_COMPOSITOR_H
+
+// just enough of a wayland compositor, on its own thread, to drive the real wayland path without a session.
+// it implements wl_compositor, wl_shm, wl_output, zxdg_output_manager_v1 and zwlr_layer_shell_v1, never
+// looks at the pixels, and counts every request and event that goes over the connection
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MOCK_MAX_OUTPUTS 8
+
+struct mock_compositor;
+
+struct mock_stats {
+	unsigned long commits; // with a buffer attached
+	unsigned long frames; // frame callbacks answered
+	unsigned long releases; // buffers released
+	unsigned long requests;
+	unsigned long events;
+};
+
+struct mock_message_count {
+	char name[64]; // interface.message
+	bool request;
+	unsigned long count;
+};
+
+// serves a single client, which wl_display_connect() will connect to through WAYLAND_SOCKET
+struct mock_compositor *start_mock_compositor(int width, int height);
+void stop_mock_compositor(struct mock_compositor *compositor);
+
+// frame callbacks are answered every refresh nanoseconds, or as soon as they are committed if 0,
+// and buffers are released release_delay milliseconds after being replaced
+void set_mock_timing(struct mock_compositor *compositor, int64_t refresh, int release_delay);
+
+// outputs are advertised and withdrawn as if plugged in and unplugged, returning the index of a new one or -1
+int add_mock_output(struct mock_compositor *compositor);
+void remove_mock_output(struct mock_compositor *compositor, int output);
+unsigned long get_mock_output_commits(struct mock_compositor *compositor, int output);
+
+struct mock_stats get_mock_stats(struct mock_compositor *compositor);
+// copies at most size of the messages seen since the last reset, returning how many there were
+int get_mock_messages(struct mock_compositor *compositor, struct mock_message_count *counts, int size);
+void reset_mock_stats(struct mock_compositor *compositor);
+
+#endif
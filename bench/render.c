@@ -0,0 +1,125 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "buffer.h"
+#include "config.h"
+#include "output.h"
+#include "render.h"
+#include "wav.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const double duration = 0.05; // seconds per measurement
+
+struct layout {
+	int bar_height;
+	int bar_width;
+	int bar_margin;
+	int roundness;
+};
+
+static double get_time(void) {
+	struct timespec timestamp;
+	clock_gettime(CLOCK_MONOTONIC, &timestamp);
+	return timestamp.tv_sec + timestamp.tv_nsec/1e9;
+}
+
+// average time to render every bar of the given kind once, or a negative value if there are none
+static double time_bucket(struct wav_output *output, enum wav_bucket_kind kind, const int *bar_heights) {
+	if (output->buckets[kind].count == 0) return -1;
+
+	long iterations = 0;
+	double start = get_time(), elapsed;
+	do {
+		render_bucket(output, kind, bar_heights);
+		++iterations;
+		elapsed = get_time() - start;
+	} while (elapsed < duration);
+	return elapsed/iterations;
+}
+
+int main(int argc, char **argv) {
+	static const int resolutions[][2] = { {1920, 1080}, {2560, 1440}, {3840, 2160} };
+	static const struct layout layouts[] = {
+		{ 16, 8, 1, 2 },
+		{ 16, 4, 1, 2 },
+		{ 16, 16, 2, 2 },
+		{ 32, 8, 1, 2 },
+		{ 16, 8, 1, 1 },
+		{ 16, 8, 1, 4 }
+	};
+	static const float fill_levels[] = { 0.25, 0.5, 1 };
+	static const char *bucket_names[BUCKET_KIND_COUNT] = {
+		[STRAIGHT_HORIZONTAL_BARS] = "straight-horizontal",
+		[STRAIGHT_VERTICAL_BARS] = "straight-vertical",
+		[SKEWED_HORIZONTAL_BARS] = "skewed-horizontal",
+		[SKEWED_VERTICAL_BARS] = "skewed-vertical",
+		[CORNER_BARS] = "corner"
+	};
+	static const char *pixel_formats[] = { "argb8888", "argb4444" };
+	static const char *colorings[] = { "solid", "gradient" };
+
+	struct wav_state state = {0};
+	init_default_config(&state.config);
+
+	bool first = true;
+	puts("[");
+	for (size_t r = 0; r < sizeof(resolutions)/sizeof(*resolutions); ++r)
+	for (size_t l = 0; l < sizeof(layouts)/sizeof(*layouts); ++l)
+	for (size_t p = 0; p < sizeof(pixel_formats)/sizeof(*pixel_formats); ++p)
+	for (size_t c = 0; c < sizeof(colorings)/sizeof(*colorings); ++c) {
+		state.config.bar_height = layouts[l].bar_height;
+		state.config.bar_width = layouts[l].bar_width;
+		state.config.bar_margin = layouts[l].bar_margin;
+		state.config.roundness = layouts[l].roundness;
+		state.config.gradient_count = c == 0 ? 0 : 2;
+		state.config.gradient[0] = 0xff2040ff;
+		state.config.gradient[1] = 0xc0ff4020;
+
+		struct wav_output output = {
+			.state = &state,
+			.scale = 1,
+			.surface_width = resolutions[r][0],
+			.surface_height = resolutions[r][1],
+			.width = resolutions[r][0],
+			.height = resolutions[r][1],
+			.pixel_format = get_pixel_format_by_name(pixel_formats[p])
+		};
+		struct wav_buffer buffer = {
+			.data = calloc((size_t) output.width*output.height, output.pixel_format->bytes_per_pixel)
+		};
+		output.free_buffer = &buffer;
+		if (buffer.data == NULL || !create_bars(&output)) {
+			fputs("Failed to set up output\n", stderr);
+			return EXIT_FAILURE;
+		}
+
+		for (int kind = 0; kind < BUCKET_KIND_COUNT; ++kind)
+		for (size_t f = 0; f < sizeof(fill_levels)/sizeof(*fill_levels); ++f) {
+			int bar_height = fill_levels[f]*output.bar_height;
+			for (int i = 0; i < output.spectrum_size; ++i) output.bar_heights[i] = bar_height;
+			double seconds = time_bucket(&output, kind, output.bar_heights);
+			if (seconds < 0) continue;
+
+			int count = output.buckets[kind].count;
+			printf("%s\t{\"width\": %d, \"height\": %d, \"pixel_format\": \"%s\", "
+					"\"bar_height\": %d, \"bar_width\": %d, \"bar_margin\": %d, \"roundness\": %d, "
+					"\"bar_type\": \"%s\", \"coloring\": \"%s\", \"fill\": %.2f, \"bars\": %d, "
+					"\"ns_per_frame\": %.0f, \"ns_per_bar\": %.1f}",
+					first ? "" : ",\n",
+					output.width, output.height, pixel_formats[p],
+					layouts[l].bar_height, layouts[l].bar_width, layouts[l].bar_margin, layouts[l].roundness,
+					bucket_names[kind], colorings[c], fill_levels[f], count,
+					seconds*1e9, seconds*1e9/count);
+			first = false;
+		}
+
+		destroy_bars(&output);
+		free(buffer.data);
+	}
+	puts("\n]");
+
+	return EXIT_SUCCESS;
+}
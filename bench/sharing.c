@@ -0,0 +1,233 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+
+#include "dsp.h"
+#include "wav.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static const double duration = 0.5; // seconds per layout
+
+// what each thread writes while running, the analysis for every spectrum and the renderer for every wakeup
+// and frame, each written as fast as it can so that any cache line they share bounces between the cores
+struct fields {
+	const char *layout;
+	unsigned *delivered;
+	atomic_uint *sequence;
+	unsigned long *wakeups;
+	_Atomic(double) *max_key;
+};
+
+struct side {
+	pthread_t thread;
+	int cpu;
+	const struct fields *fields;
+	unsigned long iterations;
+	double elapsed;
+};
+
+static alignas(WAV_CACHE_LINE) atomic_bool started, stopped;
+
+static double get_time(void) {
+	struct timespec timestamp;
+	clock_gettime(CLOCK_MONOTONIC, &timestamp);
+	return timestamp.tv_sec + timestamp.tv_nsec/1e9;
+}
+
+static void pin(struct side *side) {
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(side->cpu, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	while (!atomic_load_explicit(&started, memory_order_acquire));
+}
+
+static void *run_analysis(void *data) {
+	struct side *side = data;
+	pin(side);
+	volatile unsigned *delivered = side->fields->delivered;
+	atomic_uint *sequence = side->fields->sequence;
+	unsigned long iterations = 0;
+	double start = get_time();
+	while (!atomic_load_explicit(&stopped, memory_order_relaxed)) {
+		for (int i = 0; i < 1024; ++i) {
+			++*delivered;
+			atomic_store_explicit(sequence, atomic_load_explicit(sequence, memory_order_relaxed) + 2,
+					memory_order_release);
+		}
+		iterations += 1024;
+	}
+	side->elapsed = get_time() - start;
+	side->iterations = iterations;
+	return NULL;
+}
+
+static void *run_renderer(void *data) {
+	struct side *side = data;
+	pin(side);
+	volatile unsigned long *wakeups = side->fields->wakeups;
+	_Atomic(double) *max_key = side->fields->max_key;
+	unsigned long iterations = 0;
+	double start = get_time();
+	while (!atomic_load_explicit(&stopped, memory_order_relaxed)) {
+		for (int i = 0; i < 1024; ++i) {
+			++*wakeups;
+			atomic_store_explicit(max_key, atomic_load_explicit(max_key, memory_order_relaxed) + 1,
+					memory_order_relaxed);
+		}
+		iterations += 1024;
+	}
+	side->elapsed = get_time() - start;
+	side->iterations = iterations;
+	return NULL;
+}
+
+static bool run(const struct fields *fields, bool first) {
+	struct side analysis = { .cpu = 0, .fields = fields }, renderer = { .cpu = 1, .fields = fields };
+	atomic_store(&started, false);
+	atomic_store(&stopped, false);
+	if (pthread_create(&analysis.thread, NULL, run_analysis, &analysis) != 0 ||
+			pthread_create(&renderer.thread, NULL, run_renderer, &renderer) != 0) {
+		fputs("Failed to start threads\n", stderr);
+		return false;
+	}
+
+	atomic_store_explicit(&started, true, memory_order_release);
+	struct timespec wait = { .tv_sec = (time_t) duration, .tv_nsec = (long) ((duration - (time_t) duration)*1e9) };
+	nanosleep(&wait, NULL);
+	atomic_store_explicit(&stopped, true, memory_order_relaxed);
+	pthread_join(analysis.thread, NULL);
+	pthread_join(renderer.thread, NULL);
+
+	printf("%s\t{\"layout\": \"%s\", \"analysis_ns\": %.2f, \"renderer_ns\": %.2f}",
+			first ? "" : ",\n", fields->layout,
+			analysis.elapsed*1e9/analysis.iterations, renderer.elapsed*1e9/renderer.iterations);
+	return true;
+}
+
+// wav_state as it was before its fields were grouped by thread, field for field but with the types of today,
+// so that only the arrangement differs. max_key was a plain double then, which is the same size
+struct old_wav_peaks {
+	int size;
+	double diminish_rate;
+	float *peak;
+	int64_t *peak_time;
+	_Atomic(double) max_key;
+	bool interpolated;
+	atomic_uint sequence;
+	int latest;
+	float *history[2];
+	int64_t history_time[2];
+	float *spectrum;
+};
+
+struct old_wav_source {
+	struct wav_state *state;
+	int index;
+	const char *name;
+	pa_stream *stream;
+	pa_sample_spec sample_spec;
+	enum wav_sample_format sample_format;
+	struct old_wav_peaks peaks;
+	bool silent;
+};
+
+struct old_wav_state {
+	struct wav_config config;
+
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	struct wl_shm *shm;
+	const struct wav_pixel_format *pixel_format;
+	struct zwlr_layer_shell_v1 *layer_shell;
+	struct zxdg_output_manager_v1 *output_manager;
+	struct wp_viewporter *viewporter;
+	struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
+	struct wl_list outputs;
+	int next_source;
+	int visibilityfd;
+	bool visibility_armed;
+
+	pa_threaded_mainloop *loop;
+	struct wav_mainloop *mainloop;
+	pa_context *context;
+	struct wav_analysis *analysis;
+	bool paused;
+
+	struct old_wav_source sources[MAX_SOURCES];
+	int source_count;
+	unsigned delivered;
+	float *capture;
+	size_t capture_size;
+
+	int audiofd;
+	struct wav_dsp dsp;
+	int spectrum_size;
+	struct wav_waveform waveform;
+
+	struct wav_text *text;
+
+	struct wav_trace *trace;
+	struct wav_replay *replay;
+
+	struct wav_spectrum_header *export;
+	size_t export_size;
+
+	bool running;
+	unsigned long wakeups;
+};
+
+// the cache line of a field, from the start of the structure
+static long get_line(const void *state, const void *field) {
+	return (long) (((const char *) field - (const char *) state)/WAV_CACHE_LINE);
+}
+
+int main(int argc, char **argv) {
+	if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+		fputs("Warning: only one CPU, so the threads take turns rather than contend\n", stderr);
+	}
+
+	// wav_state as it is, against how it was laid out before
+	static struct wav_state state;
+	static struct old_wav_state old_state;
+
+	const struct fields layouts[] = {
+		{
+			.layout = "wav_state",
+			.delivered = &state.delivered,
+			.sequence = &state.sources[0].peaks.sequence,
+			.wakeups = &state.wakeups,
+			.max_key = &state.sources[0].peaks.max_key
+		},
+		{
+			.layout = "old wav_state",
+			.delivered = &old_state.delivered,
+			.sequence = &old_state.sources[0].peaks.sequence,
+			.wakeups = &old_state.wakeups,
+			.max_key = &old_state.sources[0].peaks.max_key
+		}
+	};
+	const void *bases[] = { &state, &old_state };
+
+	for (size_t i = 0; i < sizeof(layouts)/sizeof(*layouts); ++i) {
+		const struct fields *fields = &layouts[i];
+		fprintf(stderr, "Cache lines in %s: delivered %ld, sequence %ld, wakeups %ld, max_key %ld\n", fields->layout,
+				get_line(bases[i], fields->delivered), get_line(bases[i], fields->sequence),
+				get_line(bases[i], fields->wakeups), get_line(bases[i], fields->max_key));
+	}
+
+	puts("[");
+	for (size_t i = 0; i < sizeof(layouts)/sizeof(*layouts); ++i) {
+		if (!run(&layouts[i], i == 0)) return EXIT_FAILURE;
+	}
+	puts("\n]");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "color.h"
+#include "config.h"
+#include "dsp.h"
+#include "output.h"
+#include "render.h"
+#include "waterfall.h"
+#include "wav.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const double duration = 0.2; // seconds per measurement
+
+static double get_time(void) {
+	struct timespec timestamp;
+	clock_gettime(CLOCK_MONOTONIC, &timestamp);
+	return timestamp.tv_sec + timestamp.tv_nsec/1e9;
+}
+
+// the whole image moved up a line and the new one drawn at the bottom, as a single buffer would need
+static double time_full_redraw(struct wav_output *output, unsigned char *image) {
+	size_t stride = (size_t) output->width*output->pixel_format->bytes_per_pixel;
+	long iterations = 0;
+	double start = get_time(), elapsed;
+	do {
+		memmove(image, image + stride, stride*(output->height - 1));
+		render_waterfall_line(output, image + stride*(output->height - 1), get_dsp_time());
+		++iterations;
+		elapsed = get_time() - start;
+	} while (elapsed < duration);
+	return elapsed/iterations;
+}
+
+// only the new line, plus the occasional rewind to the start of the pool
+static double time_scroll(struct wav_output *output, struct wav_waterfall *waterfall) {
+	long iterations = 0;
+	double start = get_time(), elapsed;
+	do {
+		render_waterfall_line(output, scroll_waterfall(waterfall), get_dsp_time());
+		++iterations;
+		elapsed = get_time() - start;
+	} while (elapsed < duration);
+	return elapsed/iterations;
+}
+
+int main(int argc, char **argv) {
+	static const int resolutions[][2] = { {1920, 1080}, {2560, 1440}, {3840, 2160} };
+	static const char *pixel_formats[] = { "argb8888", "argb4444" };
+	static const int spectrum_size = 512;
+
+	struct wav_state state = {0};
+	init_default_config(&state.config);
+	state.config.waterfall = true;
+	state.config.gradient_count = 2;
+	state.config.gradient[0] = 0xff2040ff;
+	state.config.gradient[1] = 0xc0ff4020;
+
+	float *spectrum = malloc(spectrum_size*sizeof(*spectrum));
+	if (spectrum == NULL || !init_peaks(&state.sources[0].peaks, spectrum_size, state.config.diminish_rate, false)) {
+		fputs("Failed to set up spectrum\n", stderr);
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < spectrum_size; ++i) spectrum[i] = (float) (i % 37)/37;
+	update_peaks(&state.sources[0].peaks, spectrum, get_dsp_time());
+
+	bool first = true;
+	puts("[");
+	for (size_t r = 0; r < sizeof(resolutions)/sizeof(*resolutions); ++r)
+	for (size_t p = 0; p < sizeof(pixel_formats)/sizeof(*pixel_formats); ++p) {
+		struct wav_output output = {
+			.state = &state,
+			.width = resolutions[r][0],
+			.height = resolutions[r][1],
+			.spectrum_size = spectrum_size,
+			.amplitude_scale = 1,
+			.pixel_format = get_pixel_format_by_name(pixel_formats[p])
+		};
+
+		// the pool is laid out as create_waterfall() would, but in ordinary memory
+		struct wav_waterfall waterfall = {
+			.stride = output.width*output.pixel_format->bytes_per_pixel,
+			.height = output.height,
+			.lines = get_waterfall_lines(output.height)
+		};
+		waterfall.size = (size_t) waterfall.stride*waterfall.lines;
+		waterfall.data = calloc(1, waterfall.size);
+		unsigned char *image = calloc(output.height, waterfall.stride);
+		if (waterfall.data == NULL || image == NULL || !create_colors(&output)) {
+			fputs("Failed to set up output\n", stderr);
+			return EXIT_FAILURE;
+		}
+
+		double full = time_full_redraw(&output, image);
+		double scroll = time_scroll(&output, &waterfall);
+		printf("%s\t{\"width\": %d, \"height\": %d, \"pixel_format\": \"%s\", "
+				"\"full_redraw_ns\": %.0f, \"scroll_ns\": %.0f, \"speedup\": %.1f}",
+				first ? "" : ",\n",
+				output.width, output.height, pixel_formats[p], full*1e9, scroll*1e9, full/scroll);
+		first = false;
+
+		destroy_colors(&output);
+		free(image);
+		free(waterfall.data);
+	}
+	puts("\n]");
+
+	finish_peaks(&state.sources[0].peaks);
+	free(spectrum);
+	return EXIT_SUCCESS;
+}
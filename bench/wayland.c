@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "config.h"
+#include "dsp.h"
+#include "mock-compositor.h"
+#include "output.h"
+#include "render.h"
+#include "wav.h"
+#include "wayland.h"
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wayland-client.h>
+
+#define MAX_MESSAGES 64
+
+static const int width = 2560, height = 1440;
+static const int frame_count = 500; // per scenario
+static const int hotplug_count = 20;
+static const int spectrum_size = 1024;
+static const int64_t timeout = 20000000000; // for a scenario that has stalled
+
+struct scenario {
+	const char *name;
+	int64_t refresh; // 0 to answer frame callbacks as soon as they are committed
+	int release_delay; // in milliseconds after a buffer is replaced
+};
+
+static int64_t get_cpu_time(void) {
+	struct timespec timestamp;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &timestamp);
+	return 1000000000*(int64_t) timestamp.tv_sec + timestamp.tv_nsec;
+}
+
+// one round of the event loop. the spectrum never decays, so once woken the renderer has to keep every output
+// going on frame callbacks and buffer releases alone, and an output that misses one of them stalls the scenario
+static bool dispatch(struct wav_state *state, int64_t deadline) {
+	int64_t now = get_dsp_time();
+	if (now > deadline) {
+		fputs("Stalled waiting for the compositor\n", stderr);
+		return false;
+	}
+
+	if (wl_display_flush(state->display) < 0) return false;
+	struct pollfd pollfd = {
+		.fd = wl_display_get_fd(state->display),
+		.events = POLLIN
+	};
+	if (poll(&pollfd, 1, (deadline - now + 999999)/1000000) > 0) return wl_display_dispatch(state->display) >= 0;
+	return true;
+}
+
+static void print_messages(struct mock_compositor *compositor, unsigned long frames) {
+	struct mock_message_count counts[MAX_MESSAGES];
+	int count = get_mock_messages(compositor, counts, MAX_MESSAGES);
+	if (count > MAX_MESSAGES) count = MAX_MESSAGES;
+
+	bool first = true;
+	fputs("{", stdout);
+	for (int i = 0; i < count; ++i) {
+		if (!counts[i].request) continue;
+		printf("%s\"%s\": %.2f", first ? "" : ", ", counts[i].name, (double) counts[i].count/frames);
+		first = false;
+	}
+	fputs("}", stdout);
+}
+
+static bool run_scenario(struct wav_state *state, struct mock_compositor *compositor,
+		const struct scenario *scenario, bool first) {
+	set_mock_timing(compositor, scenario->refresh, scenario->release_delay);
+	reset_mock_stats(compositor);
+
+	// as the analysis would when audio starts, anything already waiting on a frame is left to it
+	render_frame(state);
+	int64_t start = get_dsp_time(), cpu_start = get_cpu_time();
+	while (get_mock_stats(compositor).commits < (unsigned long) frame_count) {
+		if (!dispatch(state, start + timeout)) return false;
+	}
+	int64_t elapsed = get_dsp_time() - start, cpu_time = get_cpu_time() - cpu_start;
+
+	struct mock_stats stats = get_mock_stats(compositor);
+	printf("%s\t{\"scenario\": \"%s\", \"width\": %d, \"height\": %d, \"refresh_hz\": %.1f, "
+			"\"release_delay_ms\": %d, \"frames\": %lu, \"fps\": %.1f, \"client_cpu_ns_per_frame\": %.0f, "
+			"\"requests_per_frame\": %.2f, \"events_per_frame\": %.2f, \"requests\": ",
+			first ? "" : ",\n",
+			scenario->name, width, height, scenario->refresh > 0 ? 1e9/scenario->refresh : 0,
+			scenario->release_delay, stats.commits, stats.commits*1e9/elapsed, (double) cpu_time/stats.commits,
+			(double) stats.requests/stats.commits, (double) stats.events/stats.commits);
+	print_messages(compositor, stats.commits);
+	fputs("}", stdout);
+	return true;
+}
+
+// from an output being plugged in to the first frame wav shows on it, and back out again
+static bool run_hotplug(struct wav_state *state, struct mock_compositor *compositor) {
+	set_mock_timing(compositor, 16666667, 0);
+	reset_mock_stats(compositor);
+
+	int64_t total = 0, worst = 0;
+	for (int i = 0; i < hotplug_count; ++i) {
+		int output_count = wl_list_length(&state->outputs);
+		int64_t start = get_dsp_time();
+		int output = add_mock_output(compositor);
+		if (output < 0) return false;
+		while (get_mock_output_commits(compositor, output) == 0) {
+			if (!dispatch(state, start + timeout)) return false;
+		}
+
+		int64_t elapsed = get_dsp_time() - start;
+		total += elapsed;
+		if (elapsed > worst) worst = elapsed;
+
+		remove_mock_output(compositor, output);
+		while (wl_list_length(&state->outputs) > output_count) {
+			if (!dispatch(state, start + timeout)) return false;
+		}
+	}
+
+	struct mock_stats stats = get_mock_stats(compositor);
+	printf(",\n\t{\"scenario\": \"hotplug\", \"plugs\": %d, \"ms_to_first_frame\": %.2f, \"worst_ms\": %.2f, "
+			"\"requests_per_plug\": %.1f}",
+			hotplug_count, total/1e6/hotplug_count, worst/1e6, (double) stats.requests/hotplug_count);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	static const struct scenario scenarios[] = {
+		{ "unthrottled", 0, 0 },
+		{ "60hz", 16666667, 0 },
+		{ "144hz", 6944444, 0 },
+		{ "240hz", 4166667, 0 },
+		{ "144hz-slow-release", 6944444, 12 }
+	};
+
+	struct mock_compositor *compositor = start_mock_compositor(width, height);
+	if (compositor == NULL) return EXIT_FAILURE;
+
+	struct wav_state state = {0};
+	init_default_config(&state.config);
+	atomic_store(&state.running, true);
+
+	// a spectrum that never decays, in place of audio, so that every frame has bars to draw
+	float *spectrum = malloc(spectrum_size*sizeof(*spectrum));
+	if (spectrum == NULL || !init_peaks(&state.sources[0].peaks, spectrum_size, 0, false)) {
+		fputs("Failed to set up spectrum\n", stderr);
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < spectrum_size; ++i) spectrum[i] = 1 + (float) (i % 37)/37;
+	update_peaks(&state.sources[0].peaks, spectrum, get_dsp_time());
+
+	if (!init_wayland(&state)) return EXIT_FAILURE;
+	wl_display_roundtrip(state.display); // for the configure
+
+	bool succeeded = true;
+	puts("[");
+	for (size_t i = 0; succeeded && i < sizeof(scenarios)/sizeof(*scenarios); ++i) {
+		succeeded = run_scenario(&state, compositor, &scenarios[i], i == 0);
+	}
+	succeeded = succeeded && run_hotplug(&state, compositor);
+	puts("\n]");
+
+	finish_wayland(&state);
+	finish_peaks(&state.sources[0].peaks);
+	free(spectrum);
+	stop_mock_compositor(compositor);
+	return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
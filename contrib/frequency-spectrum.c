@@ -1,5 +1,7 @@
-#include <complex.h>        // allows fftw to use native complex numbers
-#include <fftw3.h>          // fft library
+#define _POSIX_C_SOURCE 199309L
+
+#include "dsp.h"            // analysis shared with wav
+
 #include <locale.h>         // for printing wide characters
 #include <math.h>
 #include <pthread.h>        // for creating background thread
@@ -38,21 +40,6 @@ long get_time(void) {
     return timestamp.tv_sec*NANOSECONDS_IN_A_SECOND + timestamp.tv_nsec;
 }
 
-float equal_loudness_curve_low(float f) {
-    float logf = log10f(f);
-    return (-14.424*logf + 91.472)*logf - 143.88;
-}
-
-float equal_loudness_curve_middle(float f) {
-    float logf = log10f(f);
-    return ((530*logf - 4875.5)*logf + 14926.688)*logf - 15210.564;
-}
-
-float equal_loudness_curve_high(float f) {
-    float logf = log10f(f);
-    return (-101.5*logf + 708.3)*logf - 1232.1;
-}
-
 void *run(void *arguments) {
     // unpack arguments
     struct args_struct *args = (struct args_struct *)arguments;
@@ -72,26 +59,15 @@ void *run(void *arguments) {
                                    .rate = 44100 };
 
     int freq_step_size = 10;
-    int buf_size = sample_spec.rate/freq_step_size;
     int refill_size = sample_spec.rate/refresh_rate; // since the refresh rate is faster than the entire buffer can fill
                                                      // audio is read in quicker by partially filling in the buffer
                                                      // and shifting along the old values
 
-    // initialise arrays involved in the audio processing
-    float audio_raw[buf_size];
-    fftwf_complex audio_fft[buf_size/2 + 1];
-    fftwf_plan fft = fftwf_plan_dft_r2c_1d(buf_size, audio_raw, audio_fft, FFTW_PATIENT);
-    float frequency_spectrum[width];
-
-    float signal_normalisation = 1/cbrtf(buf_size);
-    float loudness_weighting[width]; // ISO 226 @ 60 phons, estimated by some fitted curves
-    for (int i = 0; i < width; i++) {
-        float f = (i+1)*freq_step_size; // ignore 0 Hz
-        float equal_loudness_value = f <= 800 ? equal_loudness_curve_low(f) :
-                                     f < 2000 ? equal_loudness_curve_middle(f) :
-                                                equal_loudness_curve_high(f);
-        loudness_weighting[i] = powf(2, equal_loudness_value/18.06)*signal_normalisation; // scaled into a percentage
-    }
+    // initialise the analysis, which also computes the equal-loudness weighting
+    struct wav_dsp dsp;
+    if (!init_dsp(&dsp, sample_spec.rate, freq_step_size, width, 1, false, FFTW_PATIENT)) exit(2);
+    float *frequency_spectrum = dsp.spectrum;
+    float refill[refill_size];
 
     long last_timestamp = get_time();
     long timestamp;
@@ -112,32 +88,15 @@ void *run(void *arguments) {
         exit(2);
     }
 
-    pa_simple_read(pulseaudio_connection, audio_raw, (buf_size - refill_size)*sizeof(float), &error);
     while (true) {
-        pa_simple_read(pulseaudio_connection, audio_raw + buf_size - refill_size, refill_size*sizeof(float), &error);
+        pa_simple_read(pulseaudio_connection, refill, refill_size*sizeof(float), &error);
+        push_dsp_samples(&dsp, 0, refill, refill_size);
 
-        *silent_p = true;
-        for (int i = 0; i < buf_size; i++) {
-            if (audio_raw[i] != 0) {
-                *silent_p = false;
-                break;
-            }
-        }
+        *silent_p = is_dsp_silent(&dsp, 0);
         if (*silent_p) continue; // skip if silent
 
-        fftwf_execute(fft);
-
-        // first shift the output along by one to discard 0 Hz
-        // take the absolute value of the complex outputs to get the amplitude
-        // then normalise the values
-        // then equalise the amplitudes according to equal-loudness contours (mainly quieten lower frequencies)
-        // for some reason, amplitude seems to follow a cubic conversion from decibels to percentage
-        // at the same time, determine the maximum amplitude, eliminating the need for an extra loop
-        float max_amplitude = 0;
-        for (int i = 0; i < width; i++) {
-            frequency_spectrum[i] = cbrtf(cabs(audio_fft[i + 1]))*loudness_weighting[i];
-            if (frequency_spectrum[i] > max_amplitude) max_amplitude = frequency_spectrum[i];
-        }
+        // the amplitudes are normalised and equalised according to equal-loudness contours
+        float max_amplitude = run_dsp(&dsp);
 
         // determine the new scale
         // which is shifted by the difference between the current scale and the current max
@@ -160,8 +119,6 @@ void *run(void *arguments) {
                 last_update[i] = timestamp;
             }
         }
-
-        memmove(audio_raw, audio_raw + refill_size, (buf_size - refill_size)*sizeof(float));
     }
 }
 
@@ -212,7 +169,7 @@ int main(int argc, char **argv) {
                                                                .silent_p = &silent,
                                                                .refresh_rate = refresh_rate });
 
-    bool no_bars;
+    bool no_bars = false;
     wchar_t blocks[] = { L' ', L'▁', L'▂', L'▃', L'▄', L'▅', L'▆', L'▇', L'█' };
     wchar_t line[width + 1];
     line[width] = '\0';
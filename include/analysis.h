@@ -0,0 +1,26 @@
+#ifndef _ANALYSIS_H
+#define _ANALYSIS_H
+
+#include "wav.h"
+
+#include <stddef.h>
+
+// a dedicated thread for the FFT, fed by the capture callback through a bounded
+// single-producer single-consumer ring for each source, so that capture never waits on analysis
+
+struct wav_analysis;
+
+struct wav_analysis *start_analysis(struct wav_state *state);
+void stop_analysis(struct wav_analysis *analysis);
+
+// blocks until the analysis thread is between transforms, and keeps it there until resumed
+void pause_analysis(struct wav_analysis *analysis);
+void resume_analysis(struct wav_analysis *analysis);
+
+// discards whatever is queued, only while paused and with capture unable to run
+void flush_analysis(struct wav_analysis *analysis);
+
+// called from the capture thread, drops samples rather than block if the ring is full
+void queue_samples(struct wav_analysis *analysis, int source, const float *samples, size_t count);
+
+#endif
@@ -8,6 +8,18 @@
 bool init_audio(struct wav_state *state);
 void finish_audio(struct wav_state *state);
 
-void diminish_bars(struct wav_state *state);
+// matches the analysis to the largest output, without interrupting capture
+bool resize_audio(struct wav_state *state);
+
+// corks the stream while nothing would show the spectrum, resuming from fresh audio
+void pause_audio(struct wav_state *state, bool paused);
+
+// the sources deliver their audio separately but are transformed together, once every one of them has
+// delivered since the last transform, or as soon as one delivers again so that a source that has stopped
+// does not hold up the rest. returns whether it is time to call analyse_audio()
+bool deliver_audio(struct wav_state *state, int source);
+
+// analyses the samples accumulated in state->dsp, on whichever thread owns the analysis
+void analyse_audio(struct wav_state *state);
 
 #endif
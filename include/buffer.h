@@ -4,15 +4,37 @@
 #include "output.h"
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <wayland-client.h>
 
+struct wav_pixel_format {
+	const char *name;
+	uint32_t shm_format;
+	int bytes_per_pixel;
+};
+
 struct wav_buffer {
 	struct wl_buffer *wl_buffer;
 	void *data;
+	size_t size; // of the mapping
+	struct wav_output *output;
+	struct wl_list link; // wav_output::retired_buffers, only once retired
 	bool busy;
+	bool pending; // a frame was skipped while the compositor held the buffer, so it is drawn on release
+	bool retired; // replaced while the compositor held it, so it is destroyed on release
 };
 
+const struct wav_pixel_format *get_pixel_format(uint32_t shm_format);
+const struct wav_pixel_format *get_pixel_format_by_name(const char *name);
+uint32_t convert_color(const struct wav_pixel_format *pixel_format, uint32_t argb);
+
+// a file of the given size in XDG_RUNTIME_DIR to share with the compositor, to be unlinked once mapped
+int create_pool_file(int size, char path[64]);
+
 struct wav_buffer *create_buffer(struct wav_output *output);
 void destroy_buffer(struct wav_buffer *buffer);
+// destroys a buffer that has been replaced, or if the compositor still holds it, once it is released
+void retire_buffer(struct wav_buffer *buffer);
 
 #endif
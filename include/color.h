@@ -0,0 +1,25 @@
+#ifndef _COLOR_H
+#define _COLOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WAV_COLOR_LEVELS 256
+
+struct wav_output;
+
+// colour lookup tables of an output, all in its pixel format with premultiplied alpha
+struct wav_colors {
+	uint32_t *bar; // per bar, NULL if the bars have a gradient
+	uint32_t *row; // per row from the edge, NULL if the bars are solid
+	uint32_t *level; // WAV_COLOR_LEVELS of them from silent to loudest, only for the waterfall
+
+	// the gradient packed as pixels, to be copied straight into the buffer
+	void *span;
+	void *reversed_span;
+};
+
+bool create_colors(struct wav_output *output);
+void destroy_colors(struct wav_output *output);
+
+#endif
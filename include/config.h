@@ -4,18 +4,52 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define MAX_COLORS 16
+#define MAX_CPUS 64
+#define MAX_SOURCES 8
+
 struct wav_config {
+	// outputs take the sources in turn, anything else only shows the first
+	const char *sources[MAX_SOURCES]; // pulseaudio source names
+	int source_count; // 0 for the default source
 	int frequency_step;
+	bool decimate; // analyse the audio at the lowest rate that covers every bar
 
 	int bar_height;
 	int bar_margin;
 	int bar_width;
 	int roundness;
+	int render_scale; // outputs are rendered at 1/render_scale of their resolution
+	int frame_budget; // in microseconds, quality is lowered while frames take longer to draw, 0 to disable
 	bool interpolated;
-	uint32_t color;
+	bool waveform; // draw the signal itself rather than its spectrum
+	bool waterfall; // draw the spectrum as a scrolling spectrogram over the whole output
+	uint32_t colors[MAX_COLORS]; // ARGB, cycled through from bar to bar
+	int color_count; // 0 for scattered hues
+	uint32_t gradient[MAX_COLORS]; // ARGB, from the edge to the tip of every bar
+	int gradient_count; // 0 for solid bars
+	const char *pixel_format; // NULL for argb8888
+	int text_columns; // draw text to stdout instead of wayland outputs, 0 to disable
+	bool swaybar; // as a swaybar status command
 
 	float diminish_rate;
 	float noise_threshold;
+
+	const char *export_name; // shared memory segment name, NULL to disable
+
+	const char *record_name; // trace file to record to, NULL to disable
+	bool record_quantised;
+	const char *replay_name; // trace file to replay instead of capturing audio, NULL to disable
+	bool replay_fast; // ignore the recorded timing
+
+	bool single_threaded; // dispatch pulseaudio on the main thread
+
+	bool analysis_thread;
+	int analysis_cpus[MAX_CPUS];
+	int analysis_cpu_count; // 0 for any
+	int analysis_priority; // SCHED_FIFO priority, 0 to keep the default policy
+	int analysis_nice;
+	bool print_stats;
 };
 
 void init_default_config(struct wav_config *config);
@@ -0,0 +1,136 @@
+#ifndef _DSP_H
+#define _DSP_H
+
+#include <complex.h> // allows fftw to use native complex numbers
+#include <fftw3.h>
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// where each stream has got to in the filter history
+struct wav_dsp_stream {
+	int history_pos;
+	int phase; // samples pushed since the last one was kept
+};
+
+// fields written by different threads are kept this far apart, so that writing one does not evict the other
+#define WAV_CACHE_LINE 64
+
+// any number of streams at the same rate, analysed together by a single batched transform.
+// each stream's part of the buffers below follows on from the one before
+struct wav_dsp {
+	int rate; // of the samples pushed
+	int frequency_step;
+	int decimation; // 1 when every sample pushed is analysed
+	int buf_size; // at rate/decimation
+	int spectrum_size;
+	int stream_count;
+	bool decimate;
+	unsigned plan_flags;
+
+	float *samples; // most recent buf_size samples of each stream, oldest first
+	fftwf_complex *fft; // buf_size/2 + 1 bins per stream
+	fftwf_plan plan;
+	float *loudness_weighting;
+	float *spectrum; // spectrum_size weighted amplitudes per stream from the last call to run_dsp()
+
+	// low-pass filter applied before decimating, NULL when every sample is analysed
+	int filter_size; // a multiple of 8
+	float *filter;
+	float *history; // per stream, the last filter_size samples pushed, stored twice so that they can be read contiguously
+	struct wav_dsp_stream *streams;
+};
+
+// with decimate, the audio is filtered and decimated down to the smallest rate that covers every bin,
+// so that the transform is no larger than the spectrum needs
+bool init_dsp(struct wav_dsp *dsp, int rate, int frequency_step, int spectrum_size, int stream_count,
+		bool decimate, unsigned plan_flags);
+void finish_dsp(struct wav_dsp *dsp);
+
+// changes the number of bins analysed, only replanning the transform if the decimation changes
+bool resize_dsp(struct wav_dsp *dsp, int spectrum_size);
+
+// the most bins that can be analysed at this rate and frequency step
+static inline int get_dsp_capacity(const struct wav_dsp *dsp) {
+	return dsp->rate/dsp->frequency_step/2;
+}
+
+// interleaved samples in native byte order
+enum wav_sample_format {
+	WAV_SAMPLE_FLOAT32,
+	WAV_SAMPLE_S16,
+	WAV_SAMPLE_S24_32, // in the low bits of 32 bit words
+	WAV_SAMPLE_S32
+};
+
+// converts frames of any number of channels to mono floats, averaging the channels
+void convert_dsp_samples(float *restrict out, const void *restrict in, size_t frames,
+		enum wav_sample_format format, int channels);
+
+// none of the following allocate
+void push_dsp_samples(struct wav_dsp *dsp, int stream, const float *samples, size_t count);
+void reset_dsp(struct wav_dsp *dsp); // forgets every sample pushed so far, on every stream
+bool is_dsp_silent(const struct wav_dsp *dsp, int stream);
+float run_dsp(struct wav_dsp *dsp); // transforms every stream at once, returns the maximum amplitude of any
+
+static inline float *get_dsp_spectrum(const struct wav_dsp *dsp, int stream) {
+	return dsp->spectrum + (size_t) stream*dsp->spectrum_size;
+}
+
+// peak-hold with linear decay, evaluated lazily: a value is only decayed when it is sampled
+struct wav_peaks {
+	int size;
+	double diminish_rate; // per second
+
+	// raised by update_peaks() while another thread samples them, so every one is loaded and stored atomically.
+	// a peak may be seen with the time of the one before it, which is off for no more than a frame
+	_Atomic(float) *peak;
+	_Atomic(int64_t) *peak_time; // in nanoseconds, see get_dsp_time()
+
+	// every value decays at the same rate, so the maximum is the largest peak + peak_time*diminish_rate,
+	// which only ever grows as peaks are raised
+	_Atomic(double) max_key;
+
+	// if interpolated, spectra are kept as they arrive instead of raising the peaks, which follow a line
+	// through the last two when advanced to the time of a frame. this lags by one spectrum
+	bool interpolated;
+	float *spectrum; // scratch space for the interpolated spectrum, only touched by advance_peaks()
+
+	// written by update_peaks(), apart from the peaks as advance_peaks() raises them on another thread
+	// seqlock over the history: odd while a spectrum is being stored, and moved on by two for every spectrum
+	// whether interpolated or not, so that it also counts them
+	alignas(WAV_CACHE_LINE) atomic_uint sequence;
+	int latest; // index into the history
+	float *history[2];
+	int64_t history_time[2]; // 0 until a spectrum has been stored
+};
+
+int64_t get_dsp_time(void); // CLOCK_MONOTONIC, in nanoseconds
+
+bool init_peaks(struct wav_peaks *peaks, int size, float diminish_rate, bool interpolated);
+void finish_peaks(struct wav_peaks *peaks);
+bool resize_peaks(struct wav_peaks *peaks, int size); // new peaks start at zero
+
+// raises every peak that has decayed below the new spectrum, or if interpolated, stores it to advance towards
+void update_peaks(struct wav_peaks *peaks, const float *spectrum, int64_t time);
+
+// if interpolated, raises the peaks to the spectrum at the given time, to be called before sampling them.
+// may run alongside update_peaks(), but not alongside itself
+void advance_peaks(struct wav_peaks *peaks, int64_t time);
+
+static inline float sample_peak(const struct wav_peaks *peaks, int i, int64_t time) {
+	float peak = atomic_load_explicit(&peaks->peak[i], memory_order_relaxed);
+	int64_t peak_time = atomic_load_explicit(&peaks->peak_time[i], memory_order_relaxed);
+	float value = peak - (time - peak_time)*1e-9*peaks->diminish_rate;
+	return value > 0 ? value : 0;
+}
+
+static inline float sample_max_peak(const struct wav_peaks *peaks, int64_t time) {
+	float value = atomic_load_explicit(&peaks->max_key, memory_order_relaxed) - time*1e-9*peaks->diminish_rate;
+	return value > 0 ? value : 0;
+}
+
+#endif
@@ -4,5 +4,6 @@
 #include "wav.h"
 
 void run_event_loop(struct wav_state *state);
+void print_event_loop_stats(struct wav_state *state);
 
 #endif
@@ -0,0 +1,19 @@
+#ifndef _MAINLOOP_H
+#define _MAINLOOP_H
+
+#include <pulse/pulseaudio.h>
+
+// an epoll-based implementation of pa_mainloop_api, so that pulseaudio can be
+// dispatched on the same thread as everything else
+
+struct wav_mainloop;
+
+struct wav_mainloop *create_mainloop(void);
+void destroy_mainloop(struct wav_mainloop *loop);
+
+pa_mainloop_api *get_mainloop_api(struct wav_mainloop *loop);
+
+// waits for and dispatches one round of events, returning -1 on failure
+int iterate_mainloop(struct wav_mainloop *loop);
+
+#endif
@@ -1,32 +1,82 @@
 #ifndef _OUTPUT_H
 #define _OUTPUT_H
 
+#include "color.h"
 #include "render.h"
 
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 
 #include <wayland-client.h>
 
+// the tiers quality is stepped down through while drawing takes longer than config.frame_budget
+enum wav_quality {
+	WAV_QUALITY_FULL,
+	WAV_QUALITY_NO_CORNERS, // the corner bars are left out
+	WAV_QUALITY_HALF_RESOLUTION, // at half the render scale, only with a viewport
+	WAV_QUALITY_COUNT
+};
+
 struct wav_output {
 	struct wav_state *state;
 
 	struct wl_output *wl_output;
+	uint32_t name; // of the wl_output global
 	struct wl_list link; // wav_state::outputs
+	int source; // index into wav_state::sources
 
 	struct wl_surface *surface;
 	struct zwlr_layer_surface_v1 *layer_surface;
+	struct wp_viewport *viewport;
+	struct wp_fractional_scale_v1 *fractional_scale;
 	struct wav_buffer *busy_buffer;
 	struct wav_buffer *free_buffer;
+	struct wl_list retired_buffers; // wav_buffer::link, replaced while the compositor still held them
+	struct wav_waterfall *waterfall; // in place of the buffers, only with config.waterfall
+	struct wl_callback *frame_callback; // NULL while idle, paced by this output's own refresh otherwise
+	int64_t frame_time; // when frame_callback was requested
+
+	// capture is paused while no output is visible
+	bool on_output; // between wl_surface.leave and wl_surface.enter
+	bool starved; // frame_callback has gone unanswered, as for obscured or powered off outputs
 
 	int32_t scale;
+	uint32_t preferred_scale; // in 120ths, 0 if unknown
+
+	// surface size is in surface-local coordinates, everything else is in buffer pixels
+	int surface_height;
+	int surface_width;
 
+	const struct wav_pixel_format *pixel_format;
 	int height;
 	int width;
+	int bar_height;
 	int spectrum_size;
 	struct wav_bar *bars;
+	struct wav_bar_bucket *buckets; // one per wav_bucket_kind
+	int *bar_heights; // of the frame being drawn
+	float amplitude_scale; // follows the loudness, bars are relative to it
+	int64_t amplitude_time; // when amplitude_scale was last updated
+	struct wav_colors colors;
+
+	enum wav_quality quality;
+	int64_t frame_cost; // nanoseconds spent drawing each frame, averaged over the last few at this quality
+	unsigned long quality_frames; // drawn since the quality last changed
+	unsigned long quality_changes;
 };
 
-void create_output(struct wav_state *state, struct wl_output *wl_output);
+void create_output(struct wav_state *state, struct wl_output *wl_output, uint32_t name);
 void destroy_output(struct wav_output *output);
+// for the outputs configured before the pixel format was settled
+void create_output_buffers(struct wav_state *state);
+
+// rebuilds the buffers if the tier renders at a different resolution
+void set_output_quality(struct wav_output *output, enum wav_quality quality);
+
+// pauses or resumes capture to match whether any output is visible
+void update_visibility(struct wav_state *state);
+// starts watching a newly requested frame callback for starvation
+void watch_frame_callback(struct wav_output *output);
+// handles state->visibilityfd expiring
+void check_visibility(struct wav_state *state);
 
 #endif
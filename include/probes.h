@@ -0,0 +1,19 @@
+#ifndef _PROBES_H
+#define _PROBES_H
+
+// USDT probes under the "wav" provider, for perf and bpftrace, built with -Dprobes=true.
+// each one is a nop until something attaches to it, and otherwise compiles away entirely
+
+#ifdef WAV_PROBES
+#include <sys/sdt.h>
+
+#define WAV_PROBE1(name, a) STAP_PROBE1(wav, name, a)
+#define WAV_PROBE2(name, a, b) STAP_PROBE2(wav, name, a, b)
+#define WAV_PROBE4(name, a, b, c, d) STAP_PROBE4(wav, name, a, b, c, d)
+#else
+#define WAV_PROBE1(name, a) do {} while (0)
+#define WAV_PROBE2(name, a, b) do {} while (0)
+#define WAV_PROBE4(name, a, b, c, d) do {} while (0)
+#endif
+
+#endif
@@ -35,9 +35,44 @@ struct wav_bar {
 	float top_end;
 };
 
+enum wav_bucket_kind {
+	STRAIGHT_HORIZONTAL_BARS, // along the top and bottom edges
+	STRAIGHT_VERTICAL_BARS, // along the left and right edges
+	SKEWED_HORIZONTAL_BARS,
+	SKEWED_VERTICAL_BARS,
+	CORNER_BARS,
+	BUCKET_KIND_COUNT
+};
+
+// the bars of one kind as a structure of arrays, so that each kind is rendered by its own loop
+struct wav_bar_bucket {
+	int count;
+	int *index; // into the spectrum
+
+	// as in wav_bar
+	float *start;
+	float *end;
+	float *top_start;
+	float *top_end;
+
+	// the line of pixels at height h is origin + step*h, where step is 1 or -1
+	int *origin;
+	int *step;
+};
+
 struct wav_output; // TODO: sort out circular dependency
 
 bool create_bars(struct wav_output *output);
-void render_frame(struct wav_state *state);
+void destroy_bars(struct wav_output *output);
+void render_bucket(struct wav_output *output, enum wav_bucket_kind kind, const int *bar_heights);
+void render_frame(struct wav_state *state); // draws every output that is not already waiting on a frame
+void render_output(struct wav_output *output); // unless it is already waiting on a frame
+
+// bars are drawn relative to a scale that follows the loudness
+void follow_amplitude(float *scale, int64_t *time, float max_amplitude, int64_t now);
+float get_bar_level(struct wav_state *state, const struct wav_peaks *peaks, int i, int64_t now, float scale); // from 0 to 1
+
+// one line of the waterfall, the whole width of the output, in the colour of each bin's level
+void render_waterfall_line(struct wav_output *output, void *line, int64_t now);
 
 #endif
@@ -0,0 +1,16 @@
+#ifndef _SPECTRUM_EXPORT_H
+#define _SPECTRUM_EXPORT_H
+
+#include "wav.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool init_spectrum_export(struct wav_state *state);
+void finish_spectrum_export(struct wav_state *state);
+
+// returns the array to write the new spectrum into, which is published by end_spectrum_export()
+float *begin_spectrum_export(struct wav_state *state);
+void end_spectrum_export(struct wav_state *state, uint32_t flags);
+
+#endif
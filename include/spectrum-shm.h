@@ -0,0 +1,61 @@
+#ifndef _SPECTRUM_SHM_H
+#define _SPECTRUM_SHM_H
+
+// layout of the shared memory segment that wav publishes its spectrum to,
+// and a small reader API for other programs
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WAV_SPECTRUM_MAGIC 0x53564157 // "WAVS"
+#define WAV_SPECTRUM_VERSION 1
+
+enum wav_spectrum_flags {
+	WAV_SPECTRUM_SILENT = 1 << 0
+};
+
+struct wav_spectrum_header {
+	atomic_uint magic; // stored last, once everything else in the header is in place
+	uint32_t version;
+	uint32_t capacity; // number of bins the segment has room for
+
+	// seqlock: odd while the writer is updating the fields below
+	atomic_uint sequence;
+
+	uint32_t bins;
+	uint32_t rate;
+	uint32_t frequency_step; // in Hz, bin i is centred on (i + 1)*frequency_step
+	uint32_t flags;
+	int64_t timestamp; // CLOCK_MONOTONIC, in nanoseconds
+	float spectrum[];
+};
+
+struct wav_spectrum_info {
+	uint32_t sequence;
+	uint32_t bins;
+	uint32_t rate;
+	uint32_t frequency_step;
+	uint32_t flags;
+	int64_t timestamp;
+};
+
+struct wav_spectrum_reader {
+	const struct wav_spectrum_header *header;
+	size_t size;
+};
+
+bool wav_spectrum_reader_open(struct wav_spectrum_reader *reader, const char *name);
+void wav_spectrum_reader_close(struct wav_spectrum_reader *reader);
+
+// cheap check for whether a new spectrum has been published since the last read
+uint32_t wav_spectrum_reader_sequence(const struct wav_spectrum_reader *reader);
+
+// copies at most size bins of a consistent snapshot into spectrum and
+// returns the number copied, or -1 if the writer was busy throughout and
+// the read should be retried later
+int wav_spectrum_reader_read(const struct wav_spectrum_reader *reader,
+		float *spectrum, int size, struct wav_spectrum_info *info);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _TEXT_H
+#define _TEXT_H
+
+// draws the spectrum as a line of block characters, to a terminal or to swaybar,
+// in place of the wayland outputs
+
+#include "wav.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum wav_text_format {
+	WAV_TEXT_TERMINAL, // only the cells that changed are rewritten
+	WAV_TEXT_SWAYBAR // the i3bar protocol, a status line is only sent when it changed
+};
+
+struct wav_text {
+	enum wav_text_format format;
+	int columns;
+
+	// a one-shot timer stands in for frame callbacks
+	int timerfd;
+	bool pending;
+
+	int *levels; // in eighths of a cell, as last written, -1 before the first line
+	int *new_levels;
+	char *line; // scratch space for what is written
+	size_t line_size;
+
+	float amplitude_scale;
+	int64_t amplitude_time;
+};
+
+bool init_text(struct wav_state *state);
+void finish_text(struct wav_state *state);
+
+void render_text(struct wav_state *state); // draws a line unless a tick is already pending
+void handle_text_tick(struct wav_state *state); // when the timer fires
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+// an append-only file of every spectrum analysed, which can be replayed in place of
+// audio capture so that a session's rendering load can be reproduced offline
+
+#include "wav.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WAV_TRACE_MAGIC 0x54564157 // "WAVT"
+#define WAV_TRACE_VERSION 1
+
+enum wav_trace_flags {
+	WAV_TRACE_QUANTISED = 1 << 0 // magnitudes are uint16_t rather than float
+};
+
+enum wav_trace_frame_flags {
+	WAV_TRACE_SILENT = 1 << 0 // no magnitudes follow
+};
+
+struct wav_trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t rate;
+	uint32_t frequency_step; // in Hz, bin i is centred on (i + 1)*frequency_step
+	uint32_t reserved;
+};
+
+// followed by bins magnitudes, padded to a multiple of 8 bytes so that every frame is aligned
+struct wav_trace_frame {
+	int64_t timestamp; // CLOCK_MONOTONIC, in nanoseconds
+	uint32_t bins;
+	uint32_t flags;
+	float scale; // quantised magnitudes are fractions of this, in 65535ths
+	uint32_t reserved;
+};
+
+bool init_trace_recording(struct wav_state *state);
+void finish_trace_recording(struct wav_state *state);
+void record_trace_frame(struct wav_state *state, const float *spectrum, int bins, uint32_t flags);
+
+// replaces init_audio() and finish_audio(), feeding the renderer from a trace
+bool start_replay(struct wav_state *state);
+void stop_replay(struct wav_state *state);
+// called for every frame drawn, a fast replay moves on to the next frame of the trace once it has been shown
+void count_replay_frame(struct wav_state *state);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _WATERFALL_H
+#define _WATERFALL_H
+
+#include "buffer.h"
+#include "output.h"
+
+#include <stddef.h>
+#include <wayland-client.h>
+
+// a scrolling spectrogram, kept in a pool that is a ring of lines. each new spectrum writes a single line
+// below the ones shown, and attaches the buffer that starts a line further into the pool
+struct wav_waterfall {
+	struct wl_shm_pool *pool;
+	unsigned char *data;
+	size_t size;
+	int stride;
+	int height; // lines shown
+	int lines; // in the pool, see get_waterfall_lines()
+	int offset; // first line shown
+	struct wl_buffer **views; // one for each offset, created once the view first reaches it
+	struct wl_buffer *shown; // attached last, NULL until the first frame
+	unsigned sequence; // of the spectrum in the bottom line, see wav_peaks::sequence
+};
+
+// lines past twice the height, so that the few buffers the compositor may still hold are never written to
+#define WATERFALL_SLACK 4
+
+static inline int get_waterfall_lines(int height) {
+	return 2*height + WATERFALL_SLACK;
+}
+
+struct wav_waterfall *create_waterfall(struct wav_output *output);
+void destroy_waterfall(struct wav_waterfall *waterfall);
+
+// moves the view on by a line, returning the line that is now at the bottom, to be drawn into
+void *scroll_waterfall(struct wav_waterfall *waterfall);
+
+// the buffer over the lines currently shown, kept until the waterfall is destroyed
+struct wl_buffer *get_waterfall_view(struct wav_waterfall *waterfall, struct wav_output *output);
+
+#endif
@@ -2,18 +2,40 @@
 #define _WAV_H
 
 #include "config.h"
+#include "dsp.h"
+#include "waveform.h"
 
+#include "fractional-scale-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 #include "xdg-output-unstable-v1-client-protocol.h"
 
-#include <complex.h> // allows fftw to use native complex numbers
-#include <fftw3.h>
 #include <pulse/pulseaudio.h>
 #include <wayland-client.h>
 
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 
+// one stream of the batched transform, each on cache lines of its own
+struct wav_source {
+	alignas(WAV_CACHE_LINE) struct wav_state *state;
+	int index; // into wav_state::sources and the streams of the transform
+	const char *name; // NULL for the default source
+	pa_stream *stream;
+	pa_sample_spec sample_spec; // of the source, but at the rate of the first one, which the stream is opened with
+	enum wav_sample_format sample_format;
+
+	// handed over from the analysis to the renderer
+	atomic_bool silent;
+	struct wav_peaks peaks;
+};
+
+// grouped by the thread that writes them once running, each group on cache lines of its own, so that
+// publishing a spectrum does not evict what every frame reads. only wav_source and wav_waveform are
+// written on one thread and read on another
 struct wav_state {
+	// set up before the other threads start, and only read until they have stopped
 	struct wav_config config;
 
 	// wayland
@@ -21,28 +43,51 @@ struct wav_state {
 	struct wl_registry *registry;
 	struct wl_compositor *compositor;
 	struct wl_shm *shm;
+	const struct wav_pixel_format *pixel_format;
+	bool pixel_format_settled; // every format the compositor supports has been advertised
 	struct zwlr_layer_shell_v1 *layer_shell;
 	struct zxdg_output_manager_v1 *output_manager;
-	struct wl_list outputs; // wav_output::link
-	bool frame_scheduled;
+	struct wp_viewporter *viewporter; // optional
+	struct wp_fractional_scale_manager_v1 *fractional_scale_manager; // optional
 
 	// audio
-	pa_threaded_mainloop *loop;
-	pa_stream *stream;
-
+	pa_threaded_mainloop *loop; // NULL when single threaded
+	struct wav_mainloop *mainloop; // NULL unless single threaded
+	pa_context *context;
+	struct wav_analysis *analysis; // NULL when analysis runs in the capture callback
 	int audiofd;
-	int buf_size;
-	float *audio_raw;
-	fftwf_complex *audio_fft;
-	fftwf_plan fft_plan;
-	int spectrum_size;
-	float *frequency_spectrum;
-	float *loudness_weighting;
-	float max_amplitude;
-	bool silent;
-
-	// state
-	bool running;
+	int source_count;
+	int spectrum_size; // only changed while the analysis is held off, see resize_audio()
+
+	struct wav_text *text; // NULL unless drawing text in place of the outputs
+
+	// tracing
+	struct wav_trace *trace; // NULL unless recording
+	struct wav_replay *replay; // NULL unless replaying, in place of capture
+
+	// spectrum export
+	_Atomic(struct wav_spectrum_header *) export; // published once the header is written
+	size_t export_size;
+
+	// the thread that dispatches wayland and renders
+	alignas(WAV_CACHE_LINE) struct wl_list outputs; // wav_output::link
+	int next_source; // for the next output to show
+	int visibilityfd; // timerfd, expires when an output may have stopped sending frame callbacks
+	bool visibility_armed;
+	bool paused; // the streams are corked as no output is visible
+	atomic_bool running; // also cleared by the replay thread and the signal handler
+	unsigned long wakeups;
+
+	// the capture callback
+	alignas(WAV_CACHE_LINE) float *capture; // a stream converted to mono
+	size_t capture_size;
+	struct wav_waveform waveform; // in place of the transform, from the first source, only with config.waveform
+
+	// the capture callback, or the analysis thread if there is one
+	alignas(WAV_CACHE_LINE) unsigned delivered; // a bit for each source that has delivered audio since the last transform
+	struct wav_dsp dsp;
+
+	struct wav_source sources[MAX_SOURCES]; // only the first while replaying
 };
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef _WAVEFORM_H
+#define _WAVEFORM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_WAVEFORM_LEVELS 24
+
+// the most recent samples, and a pyramid of their minima and maxima over blocks of 2^level samples.
+// each level is a ring indexed by block number, so a window of n blocks is read as n consecutive nodes
+struct wav_waveform {
+	size_t capacity; // samples, a power of two, at least twice the window
+	size_t window; // samples shown across all the bars
+	int levels;
+	float *samples;
+	float *min[MAX_WAVEFORM_LEVELS]; // level 0 is the samples themselves, level j has capacity >> j nodes
+	float *max[MAX_WAVEFORM_LEVELS];
+	atomic_uint_least64_t count; // samples pushed, published once every level has been updated
+};
+
+bool init_waveform(struct wav_waveform *waveform, size_t window);
+void finish_waveform(struct wav_waveform *waveform);
+
+// none of the following allocate
+void push_waveform_samples(struct wav_waveform *waveform, const float *samples, size_t count);
+void reset_waveform(struct wav_waveform *waveform);
+
+// the level at which the window is split into about columns nodes, no more than the window
+int get_waveform_level(const struct wav_waveform *waveform, int columns);
+
+static inline size_t get_waveform_node(const struct wav_waveform *waveform, int level, uint64_t node) {
+	return node & ((waveform->capacity >> level) - 1);
+}
+
+#endif
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+
+#include "analysis.h"
+#include "audio.h"
+#include "dsp.h"
+#include "wav.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// one for each source, with each end on a cache line of its own so that neither thread evicts the other's
+struct wav_ring {
+	float *samples;
+	alignas(WAV_CACHE_LINE) atomic_size_t head; // written by the capture thread
+	alignas(WAV_CACHE_LINE) atomic_size_t tail; // written by the analysis thread
+};
+
+struct wav_analysis {
+	struct wav_state *state;
+	pthread_t thread;
+	sem_t available;
+	atomic_bool posted; // available has been posted since the thread last looked at the rings
+	pthread_mutex_t lock; // held while the analysis state is in use
+	atomic_bool running;
+	size_t capacity; // of each ring, a power of two
+	atomic_ulong dropped;
+
+	struct wav_ring rings[MAX_SOURCES];
+};
+
+static void free_rings(struct wav_analysis *analysis) {
+	for (int i = 0; i < MAX_SOURCES; ++i) free(analysis->rings[i].samples);
+}
+
+static void configure_thread(struct wav_analysis *analysis) {
+	struct wav_config *config = &analysis->state->config;
+
+	if (config->analysis_cpu_count > 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (int i = 0; i < config->analysis_cpu_count; ++i) CPU_SET(config->analysis_cpus[i], &cpus);
+		if (pthread_setaffinity_np(analysis->thread, sizeof(cpus), &cpus) != 0) {
+			fputs("Warning: failed to set analysis thread affinity\n", stderr);
+		}
+	}
+
+	if (config->analysis_priority > 0) {
+		struct sched_param param = { .sched_priority = config->analysis_priority };
+		if (pthread_setschedparam(analysis->thread, SCHED_FIFO, &param) != 0) {
+			fputs("Warning: not permitted to use real-time scheduling for analysis\n", stderr);
+		}
+	}
+}
+
+static void *run_analysis(void *data) {
+	struct wav_analysis *analysis = data;
+	struct wav_state *state = analysis->state;
+
+	// nice values are per thread on linux
+	if (state->config.analysis_nice != 0 &&
+			setpriority(PRIO_PROCESS, syscall(SYS_gettid), state->config.analysis_nice) != 0) {
+		fputs("Warning: not permitted to change analysis thread nice value\n", stderr);
+	}
+
+	while (true) {
+		sem_wait(&analysis->available);
+		if (!atomic_load_explicit(&analysis->running, memory_order_relaxed)) break;
+
+		// cleared before the rings are read, so that anything queued from here on posts again
+		atomic_exchange(&analysis->posted, false);
+
+		// consume everything queued so far, so a late wakeup costs one transform rather than several
+		bool ready = false;
+		pthread_mutex_lock(&analysis->lock);
+		for (int i = 0; i < state->source_count; ++i) {
+			struct wav_ring *ring = &analysis->rings[i];
+			size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+			size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+			if (head == tail) continue;
+			while (tail != head) {
+				size_t start = tail & (analysis->capacity - 1);
+				size_t count = head - tail;
+				if (start + count > analysis->capacity) count = analysis->capacity - start;
+				push_dsp_samples(&state->dsp, i, ring->samples + start, count);
+				tail += count;
+			}
+			atomic_store_explicit(&ring->tail, tail, memory_order_release);
+			if (deliver_audio(state, i)) ready = true;
+		}
+
+		if (ready) analyse_audio(state);
+		pthread_mutex_unlock(&analysis->lock);
+	}
+
+	return NULL;
+}
+
+struct wav_analysis *start_analysis(struct wav_state *state) {
+	// the rings are aligned to cache lines, which calloc() does not promise
+	struct wav_analysis *analysis = aligned_alloc(alignof(struct wav_analysis), sizeof(*analysis));
+	if (analysis == NULL) {
+		fputs("Failed to allocate memory for analysis thread\n", stderr);
+		return NULL;
+	}
+	memset(analysis, 0, sizeof(*analysis));
+
+	// a second of audio
+	analysis->state = state;
+	analysis->capacity = 1;
+	while (analysis->capacity < (size_t) state->dsp.rate) analysis->capacity <<= 1;
+	bool allocated = true;
+	for (int i = 0; i < state->source_count; ++i) {
+		analysis->rings[i].samples = calloc(analysis->capacity, sizeof(*analysis->rings[i].samples));
+		if (analysis->rings[i].samples == NULL) allocated = false;
+	}
+	if (!allocated) {
+		fputs("Failed to allocate memory for analysis queue\n", stderr);
+		free_rings(analysis);
+		free(analysis);
+		return NULL;
+	}
+
+	sem_init(&analysis->available, 0, 0);
+	pthread_mutex_init(&analysis->lock, NULL);
+	atomic_store(&analysis->running, true);
+	if (pthread_create(&analysis->thread, NULL, run_analysis, analysis) != 0) {
+		fputs("Failed to start analysis thread\n", stderr);
+		pthread_mutex_destroy(&analysis->lock);
+		sem_destroy(&analysis->available);
+		free_rings(analysis);
+		free(analysis);
+		return NULL;
+	}
+	configure_thread(analysis);
+
+	return analysis;
+}
+
+void stop_analysis(struct wav_analysis *analysis) {
+	atomic_store(&analysis->running, false);
+	sem_post(&analysis->available);
+	pthread_join(analysis->thread, NULL);
+
+	unsigned long dropped = atomic_load(&analysis->dropped);
+	if (dropped > 0) fprintf(stderr, "Warning: analysis fell behind, %lu samples were dropped\n", dropped);
+
+	pthread_mutex_destroy(&analysis->lock);
+	sem_destroy(&analysis->available);
+	free_rings(analysis);
+	free(analysis);
+}
+
+void pause_analysis(struct wav_analysis *analysis) {
+	pthread_mutex_lock(&analysis->lock);
+}
+
+void resume_analysis(struct wav_analysis *analysis) {
+	pthread_mutex_unlock(&analysis->lock);
+}
+
+void flush_analysis(struct wav_analysis *analysis) {
+	for (int i = 0; i < analysis->state->source_count; ++i) {
+		struct wav_ring *ring = &analysis->rings[i];
+		size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		atomic_store_explicit(&ring->tail, head, memory_order_release);
+	}
+}
+
+void queue_samples(struct wav_analysis *analysis, int source, const float *samples, size_t count) {
+	struct wav_ring *ring = &analysis->rings[source];
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	size_t space = analysis->capacity - (head - tail);
+	if (count > space) {
+		atomic_fetch_add_explicit(&analysis->dropped, count - space, memory_order_relaxed);
+		count = space;
+	}
+
+	while (count > 0) {
+		size_t start = head & (analysis->capacity - 1);
+		size_t length = start + count > analysis->capacity ? analysis->capacity - start : count;
+		memcpy(ring->samples + start, samples, length*sizeof(*samples));
+		samples += length;
+		head += length;
+		count -= length;
+	}
+	atomic_store_explicit(&ring->head, head, memory_order_release);
+
+	// once per drain rather than once per packet, the thread takes everything queued when it wakes
+	if (!atomic_exchange(&analysis->posted, true)) sem_post(&analysis->available);
+}
@@ -1,152 +1,393 @@
+#include "analysis.h"
 #include "audio.h"
+#include "dsp.h"
+#include "mainloop.h"
 #include "output.h"
+#include "probes.h"
+#include "render.h"
+#include "spectrum-export.h"
+#include "spectrum-shm.h"
+#include "text.h"
+#include "trace.h"
 #include "wav.h"
 
-#include <complex.h>
-#include <fftw3.h>
 #include <pulse/pulseaudio.h>
 
-#include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/eventfd.h>
-#include <time.h>
 #include <unistd.h>
 
-void diminish_bars(struct wav_state *state) {
-	static struct timespec last_timestamp;
-	struct timespec timestamp;
-	clock_gettime(CLOCK_MONOTONIC, &timestamp);
-	long diff = 1000000000*(timestamp.tv_sec - last_timestamp.tv_sec) + timestamp.tv_nsec - last_timestamp.tv_nsec;
+static void wake_renderer(struct wav_state *state) {
+	if (state->mainloop != NULL && state->analysis == NULL) {
+		// already on the rendering thread
+		render_frame(state);
+	} else {
+		static const uint64_t signal = 1;
+		write(state->audiofd, &signal, sizeof(signal));
+	}
+}
+
+bool deliver_audio(struct wav_state *state, int source) {
+	unsigned delivered = 1u << source;
+	bool again = state->delivered & delivered;
+	state->delivered |= delivered;
+	return again || state->delivered == (1u << state->source_count) - 1;
+}
+
+void analyse_audio(struct wav_state *state) {
+	state->delivered = 0;
+	bool exporting = atomic_load_explicit(&state->export, memory_order_acquire) != NULL;
 
-	float max_amplitude = 0;
-	for (int i = 0; i < state->spectrum_size; ++i) {
-		float amplitude = state->frequency_spectrum[i] - diff*state->config.diminish_rate/1000000000.0;
-		state->frequency_spectrum[i] = amplitude > 0 ? amplitude : 0;
-		if (amplitude > max_amplitude) max_amplitude = amplitude;
+	// check for silence, the sources are transformed together unless every one of them is silent
+	bool audible = false;
+	for (int i = 0; i < state->source_count; ++i) {
+		struct wav_source *source = &state->sources[i];
+		bool silent = is_dsp_silent(&state->dsp, i);
+		bool was_silent = atomic_exchange_explicit(&source->silent, silent, memory_order_relaxed);
+		if (was_silent && !silent) wake_renderer(state);
+		if (i == 0 && silent && !was_silent && exporting) {
+			memset(begin_spectrum_export(state), 0, state->spectrum_size*sizeof(float));
+			end_spectrum_export(state, WAV_SPECTRUM_SILENT);
+		}
+		if (i == 0 && silent && !was_silent && state->trace != NULL) {
+			record_trace_frame(state, NULL, 0, WAV_TRACE_SILENT);
+		}
+		if (!silent) audible = true;
 	}
-	state->max_amplitude = max_amplitude;
+	if (!audible) return;
+
+	WAV_PROBE1(fft_start, state->dsp.buf_size);
+	run_dsp(&state->dsp);
+	WAV_PROBE1(fft_end, state->dsp.buf_size);
 
-	last_timestamp = timestamp;
+	int64_t now = get_dsp_time();
+	for (int i = 0; i < state->source_count; ++i) {
+		struct wav_source *source = &state->sources[i];
+		if (!atomic_load_explicit(&source->silent, memory_order_relaxed)) update_peaks(&source->peaks, get_dsp_spectrum(&state->dsp, i), now);
+	}
+
+	// only the first source is recorded and exported
+	if (atomic_load_explicit(&state->sources[0].silent, memory_order_relaxed)) return;
+	const float *spectrum = get_dsp_spectrum(&state->dsp, 0);
+	if (state->trace != NULL) record_trace_frame(state, spectrum, state->spectrum_size, 0);
+
+	if (exporting) {
+		memcpy(begin_spectrum_export(state), spectrum, state->spectrum_size*sizeof(*spectrum));
+		end_spectrum_export(state, 0);
+	}
 }
 
-void read_stream(pa_stream *stream, size_t nbytes, void *data) {
+// the pyramid is cheap enough to keep up to date in the capture callback, so there is no transform at all
+static void push_waveform(struct wav_state *state, const float *samples, size_t count) {
+	push_waveform_samples(&state->waveform, samples, count);
+
+	bool silent = true;
+	for (size_t i = 0; i < count; ++i) {
+		if (samples[i] != 0) silent = false;
+	}
+	if (atomic_exchange_explicit(&state->sources[0].silent, silent, memory_order_relaxed) && !silent) {
+		wake_renderer(state);
+	}
+}
+
+static void capture_stream(struct wav_source *source, pa_stream *stream) {
 	const void *stream_ptr;
+	size_t nbytes;
 	pa_stream_peek(stream, &stream_ptr, &nbytes);
 	if (stream_ptr == NULL) {
 		if (nbytes > 0) pa_stream_drop(stream);
 		return;
 	}
 
-	// append new audio to buffer
-	struct wav_state *state = data;
-	size_t new_size = nbytes/sizeof(*state->audio_raw);
-	int old_size = state->buf_size - new_size;
-	if (old_size > 0) {
-		memmove(state->audio_raw, state->audio_raw + new_size, old_size*sizeof(*state->audio_raw));
-		memcpy(state->audio_raw + old_size, stream_ptr, nbytes);
-	} else {
-		memcpy(state->audio_raw, stream_ptr - old_size, state->buf_size*sizeof(*state->audio_raw));
+	// the stream is in the source's own format, so convert and downmix it here rather than on the server
+	struct wav_state *state = source->state;
+	size_t frames = nbytes/pa_frame_size(&source->sample_spec);
+	if (frames > state->capture_size) {
+		float *capture = realloc(state->capture, frames*sizeof(*capture));
+		if (capture == NULL) {
+			fputs("Failed to allocate memory for captured audio\n", stderr);
+			pa_stream_drop(stream);
+			return;
+		}
+		state->capture = capture;
+		state->capture_size = frames;
 	}
+	convert_dsp_samples(state->capture, stream_ptr, frames, source->sample_format, source->sample_spec.channels);
 	pa_stream_drop(stream);
 
-	// check for silence
-	bool silent = true;
-	for (int i = 0; i < state->buf_size; ++i) {
-		if (state->audio_raw[i] != 0) {
-			silent = false;
-			break;
-		}
+	// there is only ever the one source with the waveform
+	if (state->config.waveform) {
+		push_waveform(state, state->capture, frames);
+		return;
 	}
-	if (state->silent && !silent) {
-		static const uint64_t signal = 1;
-		write(state->audiofd, &signal, sizeof(signal));
+
+	// append new audio to buffer, or hand it over to the analysis thread
+	if (state->analysis != NULL) {
+		queue_samples(state->analysis, source->index, state->capture, frames);
+		return;
 	}
-	state->silent = silent;
-	if (silent) return;
 
-	// perform fft
-	fftwf_execute(state->fft_plan);
+	push_dsp_samples(&state->dsp, source->index, state->capture, frames);
+	if (deliver_audio(state, source->index)) analyse_audio(state);
+}
+
+// the probes bracket every read, including those that peek nothing or fail
+void read_stream(pa_stream *stream, size_t nbytes, void *data) {
+	struct wav_source *source = data;
+	WAV_PROBE1(read_start, nbytes);
+	capture_stream(source, stream);
+	WAV_PROBE2(read_end, nbytes, atomic_load_explicit(&source->silent, memory_order_relaxed));
+}
+
+// used if the source cannot be queried
+static const pa_sample_spec default_sample_spec = {
+	.channels = 1,
+	.format = PA_SAMPLE_FLOAT32,
+	.rate = 44100
+};
 
-	diminish_bars(state);
-	for (int i = 0; i < state->spectrum_size; ++i) {
-		float amplitude = cbrtf(cabs(state->audio_fft[i + 1]))*state->loudness_weighting[i];
-		if (amplitude > state->frequency_spectrum[i]) state->frequency_spectrum[i] = amplitude;
+static void handle_context_state(pa_context *context, void *data) {
+	struct wav_state *state = data;
+	switch (pa_context_get_state(context)) {
+		case PA_CONTEXT_READY:
+			break;
+		case PA_CONTEXT_FAILED:
+			fprintf(stderr, "Failed to connect to pulseaudio: %s\n", pa_strerror(pa_context_errno(context)));
+			break;
+		default:
+			return;
 	}
+	if (state->loop != NULL) pa_threaded_mainloop_signal(state->loop, 0);
 }
 
-bool init_audio(struct wav_state *state) {
-	state->silent = true;
-	state->loop = pa_threaded_mainloop_new();
-	pa_mainloop_api *loop_api = pa_threaded_mainloop_get_api(state->loop);
+static void handle_source_info(pa_context *context, const pa_source_info *info, int eol, void *data) {
+	struct wav_source *source = data;
+	if (eol == 0 && info != NULL) source->sample_spec = info->sample_spec;
+	if (eol != 0 && source->state->loop != NULL) pa_threaded_mainloop_signal(source->state->loop, 0);
+}
+
+// with the threaded mainloop locked, or on the thread that runs the single threaded one
+static void wait_for_audio(struct wav_state *state) {
+	if (state->loop != NULL) pa_threaded_mainloop_wait(state->loop);
+	else iterate_mainloop(state->mainloop);
+}
 
-	pa_context *context = pa_context_new(loop_api, NULL);
-	pa_context_connect(context, NULL, PA_CONTEXT_NOFLAGS, NULL);
+static bool connect_context(struct wav_state *state) {
+	pa_context_connect(state->context, NULL, PA_CONTEXT_NOFLAGS, NULL);
+	while (true) {
+		pa_context_state_t context_state = pa_context_get_state(state->context);
+		if (context_state == PA_CONTEXT_READY) return true;
+		if (!PA_CONTEXT_IS_GOOD(context_state)) return false;
+		wait_for_audio(state);
+	}
+}
+
+// picks the format of the source that is recorded from, so that the server neither converts nor resamples
+static void query_sample_spec(struct wav_state *state, struct wav_source *source) {
+	const char *name = source->name != NULL ? source->name : "@DEFAULT_SOURCE@";
+	source->sample_spec = (pa_sample_spec) {0};
+	pa_operation *operation = pa_context_get_source_info_by_name(state->context, name, handle_source_info, source);
+	while (operation != NULL && pa_operation_get_state(operation) == PA_OPERATION_RUNNING) {
+		wait_for_audio(state);
+	}
+	if (operation != NULL) pa_operation_unref(operation);
+
+	if (!pa_sample_spec_valid(&source->sample_spec)) {
+		fprintf(stderr, "Warning: failed to query the audio source '%s', letting the server convert it\n", name);
+		source->sample_spec = default_sample_spec;
+	}
 
-	pa_threaded_mainloop_start(state->loop);
+	switch (source->sample_spec.format) {
+		case PA_SAMPLE_S16NE: source->sample_format = WAV_SAMPLE_S16; break;
+		case PA_SAMPLE_S24_32NE: source->sample_format = WAV_SAMPLE_S24_32; break;
+		case PA_SAMPLE_S32NE: source->sample_format = WAV_SAMPLE_S32; break;
+		default:
+			// anything else is converted by the server, but at least not resampled
+			source->sample_spec.format = PA_SAMPLE_FLOAT32NE;
+			source->sample_format = WAV_SAMPLE_FLOAT32;
+			break;
+	}
 
-	static const pa_sample_spec sample_spec = {
-		.channels = 1,
-		.format = PA_SAMPLE_FLOAT32,
-		.rate = 44100
-	};
+	// every stream shares the one transform, so the rest are resampled to the rate of the first
+	if (source->index > 0) source->sample_spec.rate = state->sources[0].sample_spec.rate;
+}
 
-	state->buf_size = sample_spec.rate/state->config.frequency_step;
-	state->audio_raw = calloc(state->buf_size, sizeof(float));
-	state->audio_fft = calloc(state->buf_size/2 + 1, sizeof(fftw_complex));
-	state->fft_plan = fftwf_plan_dft_r2c_1d(state->buf_size, state->audio_raw, state->audio_fft, FFTW_PATIENT);
+static int get_max_spectrum_size(struct wav_state *state) {
 	int max_spectrum_size = 0;
 	struct wav_output *output;
 	wl_list_for_each(output, &state->outputs, link) {
 		if (output->spectrum_size > max_spectrum_size) max_spectrum_size = output->spectrum_size;
 	}
+	if (state->text != NULL && state->text->columns > max_spectrum_size) max_spectrum_size = state->text->columns;
+	return max_spectrum_size;
+}
+
+// peaks are updated from the whole spectrum, so there must never be more of them
+static bool resize_source_peaks(struct wav_state *state, int size) {
+	bool resized = true;
+	for (int i = 0; i < state->source_count; ++i) {
+		if (!resize_peaks(&state->sources[i].peaks, size)) resized = false;
+	}
+	return resized;
+}
+
+bool init_audio(struct wav_state *state) {
+	state->source_count = state->config.source_count > 0 ? state->config.source_count : 1;
+	for (int i = 0; i < state->source_count; ++i) {
+		state->sources[i] = (struct wav_source) {
+			.state = state,
+			.index = i,
+			.name = state->config.source_count > 0 ? state->config.sources[i] : NULL,
+			.silent = true
+		};
+	}
+
+	pa_mainloop_api *loop_api;
+	if (state->config.single_threaded) {
+		state->mainloop = create_mainloop();
+		if (state->mainloop == NULL) return false;
+		loop_api = get_mainloop_api(state->mainloop);
+	} else {
+		state->loop = pa_threaded_mainloop_new();
+		loop_api = pa_threaded_mainloop_get_api(state->loop);
+	}
+
+	// the analysis depends on the sample rate, so the source is queried before anything else
+	state->context = pa_context_new(loop_api, NULL);
+	pa_context_set_state_callback(state->context, handle_context_state, state);
+	if (state->loop != NULL) {
+		pa_threaded_mainloop_lock(state->loop);
+		pa_threaded_mainloop_start(state->loop);
+	}
+	bool connected = connect_context(state);
+	for (int i = 0; connected && i < state->source_count; ++i) query_sample_spec(state, &state->sources[i]);
+	if (state->loop != NULL) pa_threaded_mainloop_unlock(state->loop);
+	if (!connected) return false;
+
+	// the transform still keeps track of the spectrum size in waveform mode, but is never run
+	bool waveform = state->config.waveform;
+	int max_spectrum_size = get_max_spectrum_size(state);
 	state->spectrum_size = max_spectrum_size;
-	state->frequency_spectrum = calloc(max_spectrum_size, sizeof(float));
-	state->loudness_weighting = calloc(max_spectrum_size, sizeof(float));
-	if (state->audio_raw == NULL || state->audio_fft == NULL ||
-			state->fft_plan == NULL || state->frequency_spectrum == NULL) {
+	bool initialised = init_dsp(&state->dsp, state->sources[0].sample_spec.rate, state->config.frequency_step,
+			max_spectrum_size, state->source_count, state->config.decimate && !waveform,
+			waveform ? FFTW_ESTIMATE : FFTW_PATIENT) &&
+			(!waveform || init_waveform(&state->waveform, state->dsp.rate/state->dsp.frequency_step));
+	for (int i = 0; initialised && i < state->source_count; ++i) {
+		initialised = init_peaks(&state->sources[i].peaks, max_spectrum_size, state->config.diminish_rate,
+				state->config.interpolated);
+	}
+	if (!initialised) {
 		fputs("Failed to initialised audio\n", stderr);
 		return false;
 	}
 
-	float signal_normalisation = 1/cbrtf(state->buf_size);
-	for (int i = 0; i < max_spectrum_size; ++i) {
+	state->audiofd = eventfd(0, 0);
 
-		float f = (i+1)*state->config.frequency_step;
-		float logf = log10f(f);
-		float equal_loudness_value =
-			f <= 800 ? (-14.424*logf + 91.472)*logf - 143.88 :
-			f < 2000 ? ((530*logf - 4875.5)*logf + 14926.688)*logf - 15210.564 :
-			(-101.5*logf + 708.3)*logf - 1232.1;
-		state->loudness_weighting[i] = powf(2, equal_loudness_value/18.06)*signal_normalisation;
-	}
+	if (!init_trace_recording(state)) return false;
 
-	state->audiofd = eventfd(0, 0);
+	// the segment has to be complete before the first spectrum is written to it
+	if (!init_spectrum_export(state)) return false;
 
-	while (pa_context_get_state(context) != PA_CONTEXT_READY) {}
+	if (state->config.analysis_thread && !waveform) {
+		state->analysis = start_analysis(state);
+		if (state->analysis == NULL) return false;
+	}
+
+	if (state->loop != NULL) pa_threaded_mainloop_lock(state->loop);
+	for (int i = 0; i < state->source_count; ++i) {
+		struct wav_source *source = &state->sources[i];
+		source->stream = pa_stream_new(state->context, "Frequency spectrum", &source->sample_spec, NULL);
+		pa_stream_set_read_callback(source->stream, read_stream, source);
+		pa_stream_connect_record(source->stream, source->name, NULL, PA_STREAM_NOFLAGS);
+	}
+	if (state->loop != NULL) pa_threaded_mainloop_unlock(state->loop);
 
-	state->stream = pa_stream_new(context, "Frequency spectrum", &sample_spec, NULL);
-	pa_stream_set_read_callback(state->stream, read_stream, state);
-	pa_stream_connect_record(state->stream, NULL, NULL, PA_STREAM_NOFLAGS);
+	// outputs may all have been hidden or closed before capture started
+	update_visibility(state);
 
 	return true;
 }
 
+bool resize_audio(struct wav_state *state) {
+	if (state->dsp.plan == NULL) return true; // not running
+	int spectrum_size = get_max_spectrum_size(state);
+	if (spectrum_size == state->spectrum_size) return true;
+
+	// only the buffers that depend on the number of bars change, so capture carries on
+	// and only needs to be held off while they move
+	if (state->analysis != NULL) pause_analysis(state->analysis);
+	else if (state->loop != NULL) pa_threaded_mainloop_lock(state->loop);
+
+	bool resized = resize_source_peaks(state, spectrum_size) && resize_dsp(&state->dsp, spectrum_size);
+	if (!resized) resize_source_peaks(state, state->dsp.spectrum_size);
+	state->spectrum_size = state->dsp.spectrum_size;
+
+	if (state->analysis != NULL) resume_analysis(state->analysis);
+	else if (state->loop != NULL) pa_threaded_mainloop_unlock(state->loop);
+
+	return resized;
+}
+
+void pause_audio(struct wav_state *state, bool paused) {
+	if (state->sources[0].stream == NULL || state->paused == paused) return;
+	state->paused = paused;
+
+	if (state->loop != NULL) pa_threaded_mainloop_lock(state->loop);
+	if (state->analysis != NULL) pause_analysis(state->analysis);
+
+	for (int i = 0; i < state->source_count; ++i) {
+		struct wav_source *source = &state->sources[i];
+		pa_operation *operation = pa_stream_cork(source->stream, paused, NULL, NULL);
+		if (operation != NULL) pa_operation_unref(operation);
+		if (paused) {
+			// stop drawing, as no more audio will come to let the bars fall
+			atomic_store_explicit(&source->silent, true, memory_order_relaxed);
+		} else {
+			// drop whatever was captured before the stream was corked, so the first transform is only of new audio
+			operation = pa_stream_flush(source->stream, NULL, NULL);
+			if (operation != NULL) pa_operation_unref(operation);
+		}
+	}
+	if (!paused) {
+		// the capture callback cannot run until the mainloop is unlocked, so nothing is queued behind this
+		if (state->analysis != NULL) flush_analysis(state->analysis);
+		reset_dsp(&state->dsp);
+		state->delivered = 0;
+		if (state->config.waveform) reset_waveform(&state->waveform);
+	}
+
+	if (state->analysis != NULL) resume_analysis(state->analysis);
+	if (state->loop != NULL) pa_threaded_mainloop_unlock(state->loop);
+}
+
 void finish_audio(struct wav_state *state) {
-	pa_stream_disconnect(state->stream);
-	pa_stream_unref(state->stream);
+	// nothing is dispatched after this, so the stream and context can be torn down without locking
+	if (state->loop != NULL) pa_threaded_mainloop_stop(state->loop);
+
+	for (int i = 0; i < state->source_count; ++i) {
+		struct wav_source *source = &state->sources[i];
+		if (source->stream == NULL) continue;
+		pa_stream_disconnect(source->stream);
+		pa_stream_unref(source->stream);
+		source->stream = NULL;
+	}
 
-	pa_context *context = pa_stream_get_context(state->stream);
-	pa_context_disconnect(context);
-	pa_context_unref(context);
+	pa_context_disconnect(state->context);
+	pa_context_unref(state->context);
 
-	pa_threaded_mainloop_stop(state->loop);
-	pa_threaded_mainloop_free(state->loop);
+	if (state->loop != NULL) pa_threaded_mainloop_free(state->loop);
+	if (state->mainloop != NULL) destroy_mainloop(state->mainloop);
+	if (state->analysis != NULL) stop_analysis(state->analysis);
 
-	free(state->frequency_spectrum);
-	fftwf_destroy_plan(state->fft_plan);
-	free(state->audio_fft);
-	free(state->audio_raw);
+	finish_trace_recording(state);
+	finish_spectrum_export(state);
+	free(state->capture);
+	close(state->audiofd);
+	for (int i = 0; i < state->source_count; ++i) finish_peaks(&state->sources[i].peaks);
+	finish_dsp(&state->dsp);
+	if (state->config.waveform) finish_waveform(&state->waveform);
 }
@@ -2,6 +2,8 @@
 
 #include "buffer.h"
 #include "output.h"
+#include "probes.h"
+#include "render.h"
 #include "wav.h"
 
 #include <stdbool.h>
@@ -12,7 +14,42 @@
 #include <unistd.h>
 #include <wayland-client.h>
 
-static int create_pool_file(int size, char path[64]) {
+// the compact formats band gradients and blended colours, so they are only used when requested
+static const struct wav_pixel_format pixel_formats[] = {
+	{ "argb4444", WL_SHM_FORMAT_ARGB4444, 2 },
+	{ "argb1555", WL_SHM_FORMAT_ARGB1555, 2 }, // alpha is only a single bit
+	{ "argb8888", WL_SHM_FORMAT_ARGB8888, 4 }
+};
+
+static const int pixel_format_count = sizeof(pixel_formats)/sizeof(*pixel_formats);
+
+const struct wav_pixel_format *get_pixel_format(uint32_t shm_format) {
+	for (int i = 0; i < pixel_format_count; ++i) {
+		if (pixel_formats[i].shm_format == shm_format) return &pixel_formats[i];
+	}
+	return NULL;
+}
+
+const struct wav_pixel_format *get_pixel_format_by_name(const char *name) {
+	for (int i = 0; i < pixel_format_count; ++i) {
+		if (strcmp(pixel_formats[i].name, name) == 0) return &pixel_formats[i];
+	}
+	return NULL;
+}
+
+uint32_t convert_color(const struct wav_pixel_format *pixel_format, uint32_t argb) {
+	uint32_t a = argb >> 24, r = (argb >> 16) & 0xff, g = (argb >> 8) & 0xff, b = argb & 0xff;
+	switch (pixel_format->shm_format) {
+		case WL_SHM_FORMAT_ARGB4444:
+			return (a >> 4) << 12 | (r >> 4) << 8 | (g >> 4) << 4 | b >> 4;
+		case WL_SHM_FORMAT_ARGB1555:
+			return (a >> 7) << 15 | (r >> 3) << 10 | (g >> 3) << 5 | b >> 3;
+		default:
+			return argb;
+	}
+}
+
+int create_pool_file(int size, char path[64]) {
 	static const char *template = "wav-XXXXXX";
 	const char *dir = getenv("XDG_RUNTIME_DIR");
 	if (dir == NULL) {
@@ -39,7 +76,17 @@ static int create_pool_file(int size, char path[64]) {
 
 static void release_buffer(void *data, struct wl_buffer *wl_buffer) {
 	struct wav_buffer *buffer = data;
-	buffer->busy = false;
+	struct wav_output *output = buffer->output;
+	bool pending = buffer->pending;
+	buffer->busy = buffer->pending = false;
+	WAV_PROBE1(buffer_release, buffer);
+	if (buffer->retired) {
+		wl_list_remove(&buffer->link);
+		destroy_buffer(buffer);
+	}
+
+	// nothing else would draw the output again until the audio wakes the renderer
+	if (pending) render_output(output);
 }
 
 struct wav_buffer *create_buffer(struct wav_output *output) {
@@ -48,19 +95,22 @@ struct wav_buffer *create_buffer(struct wav_output *output) {
 		fputs("Failed to allocate memory for buffer object\n", stderr);
 		return NULL;
 	}
-	buffer->busy = false;
+	buffer->output = output;
+	buffer->busy = buffer->pending = buffer->retired = false;
 
-	int stride = 4 * output->width;
+	const struct wav_pixel_format *pixel_format = output->pixel_format;
+	int stride = pixel_format->bytes_per_pixel * output->width;
 	int size = stride * output->height;
 	char path[64];
 	int fd = create_pool_file(size, path);
 	if (fd >= 0) {
 		buffer->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		buffer->size = size;
 		if (buffer->data != MAP_FAILED) {
 			struct wl_shm_pool *pool = wl_shm_create_pool(output->state->shm, fd, size);
 
 			buffer->wl_buffer = wl_shm_pool_create_buffer(pool, 0,
-					output->width, output->height, stride, WL_SHM_FORMAT_ARGB8888);
+					output->width, output->height, stride, pixel_format->shm_format);
 			static const struct wl_buffer_listener buffer_listener = {
 				.release = release_buffer
 			};
@@ -85,5 +135,15 @@ struct wav_buffer *create_buffer(struct wav_output *output) {
 
 void destroy_buffer(struct wav_buffer *buffer) {
 	wl_buffer_destroy(buffer->wl_buffer);
+	munmap(buffer->data, buffer->size);
 	free(buffer);
 }
+
+void retire_buffer(struct wav_buffer *buffer) {
+	if (!buffer->busy) {
+		destroy_buffer(buffer);
+		return;
+	}
+	buffer->retired = true;
+	wl_list_insert(&buffer->output->retired_buffers, &buffer->link);
+}
@@ -0,0 +1,111 @@
+#include "buffer.h"
+#include "color.h"
+#include "output.h"
+#include "wav.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the wl_shm argb formats have premultiplied alpha
+static uint32_t premultiply_color(uint32_t argb) {
+	uint32_t a = argb >> 24;
+	uint32_t r = ((argb >> 16) & 0xff)*a/0xff, g = ((argb >> 8) & 0xff)*a/0xff, b = (argb & 0xff)*a/0xff;
+	return a << 24 | r << 16 | g << 8 | b;
+}
+
+static uint32_t interpolate_color(uint32_t from, uint32_t to, float t) {
+	uint32_t color = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		float a = (from >> shift) & 0xff, b = (to >> shift) & 0xff;
+		color |= (uint32_t) lroundf(a + (b - a)*t) << shift;
+	}
+	return color;
+}
+
+static uint32_t get_gradient_color(const struct wav_config *config, int row, int rows) {
+	if (config->gradient_count == 1 || rows <= 1) return config->gradient[0];
+
+	float position = (float) row/(rows - 1)*(config->gradient_count - 1);
+	int i = position;
+	if (i >= config->gradient_count - 1) return config->gradient[config->gradient_count - 1];
+	return interpolate_color(config->gradient[i], config->gradient[i + 1], position - i);
+}
+
+static void store_pixel(void *span, int i, int bytes_per_pixel, uint32_t pixel) {
+	if (bytes_per_pixel == 2) ((uint16_t *) span)[i] = pixel;
+	else ((uint32_t *) span)[i] = pixel;
+}
+
+// the gradient, or else the first colour, fading in from transparent
+static bool create_level_colors(struct wav_output *output) {
+	const struct wav_config *config = &output->state->config;
+	struct wav_colors *colors = &output->colors;
+	colors->level = malloc(WAV_COLOR_LEVELS*sizeof(*colors->level));
+	if (colors->level == NULL) {
+		fputs("Failed to allocate memory for colour tables\n", stderr);
+		return false;
+	}
+
+	for (int i = 0; i < WAV_COLOR_LEVELS; ++i) {
+		uint32_t argb = config->gradient_count > 0 ? get_gradient_color(config, i, WAV_COLOR_LEVELS) :
+			config->color_count > 0 ? config->colors[0] : 0xffffffff;
+		uint32_t alpha = (argb >> 24)*i/(WAV_COLOR_LEVELS - 1);
+		colors->level[i] = convert_color(output->pixel_format, premultiply_color(alpha << 24 | (argb & 0xffffff)));
+	}
+	return true;
+}
+
+bool create_colors(struct wav_output *output) {
+	const struct wav_config *config = &output->state->config;
+	const struct wav_pixel_format *pixel_format = output->pixel_format;
+	struct wav_colors *colors = &output->colors;
+	if (config->waterfall) return create_level_colors(output);
+
+	if (config->gradient_count == 0) {
+		colors->bar = malloc(output->spectrum_size*sizeof(*colors->bar));
+		if (colors->bar == NULL) {
+			fputs("Failed to allocate memory for colour tables\n", stderr);
+			return false;
+		}
+
+		for (int i = 0; i < output->spectrum_size; ++i) {
+			uint32_t argb = config->color_count > 0 ? config->colors[i % config->color_count] :
+				0xc0000000 | (((uint32_t) i * 265443761) % (1<<24)); // scattered hues
+			colors->bar[i] = convert_color(pixel_format, premultiply_color(argb));
+		}
+		return true;
+	}
+
+	int rows = output->bar_height > 0 ? output->bar_height : 1;
+	int bytes_per_pixel = pixel_format->bytes_per_pixel;
+	colors->row = malloc(rows*sizeof(*colors->row));
+	colors->span = malloc(rows*bytes_per_pixel);
+	colors->reversed_span = malloc(rows*bytes_per_pixel);
+	if (colors->row == NULL || colors->span == NULL || colors->reversed_span == NULL) {
+		fputs("Failed to allocate memory for colour tables\n", stderr);
+		destroy_colors(output);
+		return false;
+	}
+
+	for (int h = 0; h < rows; ++h) {
+		uint32_t pixel = convert_color(pixel_format, premultiply_color(get_gradient_color(config, h, rows)));
+		colors->row[h] = pixel;
+		store_pixel(colors->span, h, bytes_per_pixel, pixel);
+		store_pixel(colors->reversed_span, rows - 1 - h, bytes_per_pixel, pixel);
+	}
+	return true;
+}
+
+void destroy_colors(struct wav_output *output) {
+	struct wav_colors *colors = &output->colors;
+	free(colors->bar);
+	free(colors->row);
+	free(colors->level);
+	free(colors->span);
+	free(colors->reversed_span);
+	*colors = (struct wav_colors) {0};
+}
@@ -1,21 +1,46 @@
+#define _GNU_SOURCE // CPU_SETSIZE
+
 #include "config.h"
 
 #include <errno.h>
 #include <getopt.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 void init_default_config(struct wav_config *config) {
+	config->source_count = 0;
 	config->frequency_step = 10;
+	config->decimate = false;
 	config->bar_height = 16;
 	config->bar_margin = 1;
 	config->bar_width = 8;
 	config->roundness = 2;
+	config->render_scale = 1;
+	config->frame_budget = 0;
 	config->interpolated = false;
+	config->waveform = false;
+	config->waterfall = false;
+	config->color_count = 0;
+	config->gradient_count = 0;
+	config->pixel_format = NULL;
+	config->text_columns = 0;
+	config->swaybar = false;
 	config->diminish_rate = 0.5;
 	config->noise_threshold = 0.5;
+	config->export_name = NULL;
+	config->record_name = NULL;
+	config->record_quantised = false;
+	config->replay_name = NULL;
+	config->replay_fast = false;
+	config->single_threaded = false;
+	config->analysis_thread = false;
+	config->analysis_cpu_count = 0;
+	config->analysis_priority = 0;
+	config->analysis_nice = 0;
+	config->print_stats = false;
 }
 
 static bool parse_int(const char *string, int *out) {
@@ -43,15 +68,72 @@ static bool parse_color(const char *string, uint32_t *out) {
 	return true;
 }
 
+// comma separated
+static bool parse_color_list(const char *string, uint32_t *colors, int *count) {
+	*count = 0;
+	while (true) {
+		size_t len = strcspn(string, ",");
+		char color[16];
+		if (*count == MAX_COLORS || len >= sizeof(color)) return false;
+
+		memcpy(color, string, len);
+		color[len] = '\0';
+		if (!parse_color(color, &colors[(*count)++])) return false;
+
+		if (string[len] == '\0') return true;
+		string += len + 1;
+	}
+}
+
+// comma separated, each one a cpu_set_t can hold
+static bool parse_cpu_list(const char *string, int *cpus, int *count) {
+	*count = 0;
+	while (true) {
+		errno = 0;
+		char *end;
+		long cpu = strtol(string, &end, 10);
+		if (*count == MAX_CPUS || errno != 0 || end == string || cpu < 0 || cpu >= CPU_SETSIZE) return false;
+		cpus[(*count)++] = (int) cpu;
+
+		if (*end == '\0') return true;
+		if (*end != ',') return false;
+		string = end + 1;
+	}
+}
+
 static bool parse_option(const char c, const char *value, struct wav_config *config) {
 	switch (c) {
+		case 'A':
+			if (config->source_count == MAX_SOURCES) return false;
+			config->sources[config->source_count++] = optarg;
+			return true;
 		case 'f': return parse_int(optarg, &config->frequency_step);
+		case 'D': config->decimate = true; return true;
 		case 'H': return parse_int(optarg, &config->bar_height);
 		case 'm': return parse_int(optarg, &config->bar_margin);
 		case 'w': return parse_int(optarg, &config->bar_width);
 		case 'r': return parse_int(optarg, &config->roundness);
-		case 'i': return false;
-		case 'c': return parse_color(optarg, &config->color);
+		case 's': return parse_int(optarg, &config->render_scale) && config->render_scale > 0;
+		case 'b': return parse_int(optarg, &config->frame_budget);
+		case 'i': config->interpolated = true; return true;
+		case 'W': config->waveform = true; return true;
+		case 'L': config->waterfall = true; return true;
+		case 'c': return parse_color_list(optarg, config->colors, &config->color_count);
+		case 'g': return parse_color_list(optarg, config->gradient, &config->gradient_count);
+		case 'p': config->pixel_format = optarg; return true;
+		case 'T': return parse_int(optarg, &config->text_columns) && config->text_columns > 0;
+		case 'B': config->swaybar = true; return true;
+		case 'e': config->export_name = optarg; return true;
+		case 't': config->record_name = optarg; return true;
+		case 'q': config->record_quantised = true; return true;
+		case 'P': config->replay_name = optarg; return true;
+		case 'F': config->replay_fast = true; return true;
+		case 'S': config->single_threaded = true; return true;
+		case 'a': config->analysis_thread = true; return true;
+		case 'C': return parse_cpu_list(optarg, config->analysis_cpus, &config->analysis_cpu_count);
+		case 'R': return parse_int(optarg, &config->analysis_priority);
+		case 'N': return parse_int(optarg, &config->analysis_nice);
+		case 'V': config->print_stats = true; return true;
 		// case 'd': return parse_float(optarg, &config->diminish_rate);
 		// case 'n': return parse_float(optarg, &config->noise_threshold);
 		default: return false;
@@ -61,22 +143,43 @@ static bool parse_option(const char c, const char *value, struct wav_config *con
 int parse_config(struct wav_config *config, int argc, char **argv) {
 	static const struct option long_options[] = {
 		{"help", no_argument, NULL, 'h'},
+		{"source", required_argument, NULL, 'A'},
 		{"frequency-step", required_argument, NULL, 'f'},
+		{"decimate", no_argument, NULL, 'D'},
 		{"height", required_argument, NULL, 'H'},
 		{"margin", required_argument, NULL, 'm'},
 		{"width", required_argument, NULL, 'w'},
 		{"roundness", required_argument, NULL, 'r'},
+		{"render-scale", required_argument, NULL, 's'},
+		{"frame-budget", required_argument, NULL, 'b'},
 		{"interpolated", no_argument, NULL, 'i'},
-		{"color", no_argument, NULL, 'c'},
+		{"waveform", no_argument, NULL, 'W'},
+		{"waterfall", no_argument, NULL, 'L'},
+		{"color", required_argument, NULL, 'c'},
+		{"gradient", required_argument, NULL, 'g'},
 		{"diminish-rate", required_argument, NULL, 'd'},
 		{"noise-threshold", required_argument, NULL, 'n'},
 		{"output", required_argument, NULL, 'o'},
+		{"pixel-format", required_argument, NULL, 'p'},
+		{"text", required_argument, NULL, 'T'},
+		{"swaybar", no_argument, NULL, 'B'},
+		{"export", required_argument, NULL, 'e'},
+		{"record", required_argument, NULL, 't'},
+		{"quantise", no_argument, NULL, 'q'},
+		{"replay", required_argument, NULL, 'P'},
+		{"replay-fast", no_argument, NULL, 'F'},
+		{"single-thread", no_argument, NULL, 'S'},
+		{"analysis-thread", no_argument, NULL, 'a'},
+		{"analysis-cpus", required_argument, NULL, 'C'},
+		{"analysis-priority", required_argument, NULL, 'R'},
+		{"analysis-nice", required_argument, NULL, 'N'},
+		{"stats", no_argument, NULL, 'V'},
 		{0}
 	};
 
 	int number_of_outputs = 0;
 	while (true) {
-		int c = getopt_long(argc, argv, "hf:H:m:w:r:id:n:o:", long_options, NULL);
+		int c = getopt_long(argc, argv, "hA:f:DH:m:w:r:s:b:iWLc:g:d:n:o:p:T:Be:t:qP:FSaC:R:N:V", long_options, NULL);
 		if (c == -1) break;
 		if (c == ':' || c == '?') return -1;
 		if (c == 'h') return 1;
@@ -88,7 +191,7 @@ int parse_config(struct wav_config *config, int argc, char **argv) {
 	optind = 1;
 	while (true) {
 		int option_index = -1;
-		int c = getopt_long(argc, argv, "hf:H:m:w:r:id:n:o:", long_options, &option_index);
+		int c = getopt_long(argc, argv, "hA:f:DH:m:w:r:s:b:iWLc:g:d:n:o:p:T:Be:t:qP:FSaC:R:N:V", long_options, &option_index);
 		if (c == -1) return 0;
 
 		if (!parse_option(c, optarg, config)) {
@@ -0,0 +1,501 @@
+#define _XOPEN_SOURCE 600 // M_PI
+
+#include "dsp.h"
+
+#include <complex.h>
+#include <fftw3.h>
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_DECIMATION 16
+
+// ISO 226 at 60 phons, estimated by some fitted curves
+static float equal_loudness(float f) {
+	float logf = log10f(f);
+	return f <= 800 ? (-14.424*logf + 91.472)*logf - 143.88 :
+		f < 2000 ? ((530*logf - 4875.5)*logf + 14926.688)*logf - 15210.564 :
+		(-101.5*logf + 708.3)*logf - 1232.1;
+}
+
+static void weigh_loudness(struct wav_dsp *dsp, int start, int end) {
+	// the amplitude seems to follow a cubic conversion from decibels to percentage
+	float signal_normalisation = 1/cbrtf(dsp->buf_size);
+	for (int i = start; i < end; ++i) {
+		float f = (i + 1)*(float) dsp->rate/dsp->decimation/dsp->buf_size; // ignore 0 Hz
+		dsp->loudness_weighting[i] = powf(2, equal_loudness(f)/18.06)*signal_normalisation;
+	}
+}
+
+// the largest factor that leaves the decimated rate at least 2.5 times the highest bin,
+// so that the filter has room to roll off before anything aliases onto the spectrum
+static int get_decimation(const struct wav_dsp *dsp, int spectrum_size) {
+	if (!dsp->decimate) return 1;
+	int max_frequency = (spectrum_size + 1)*dsp->frequency_step;
+	int decimation = 2*dsp->rate/(5*max_frequency);
+	if (decimation < 1) return 1;
+	return decimation < MAX_DECIMATION ? decimation : MAX_DECIMATION;
+}
+
+// a blackman-windowed sinc with its cutoff at the decimated nyquist frequency, which keeps aliases
+// about 74 dB down once the transition band between the highest bin and its mirror image is wide enough
+static void design_filter(struct wav_dsp *dsp, int taps) {
+	float cutoff = 0.5f/dsp->decimation; // in cycles per sample
+	float centre = (taps - 1)/2.0f, sum = 0;
+	for (int i = 0; i < taps; ++i) {
+		float t = i - centre;
+		float sinc = t == 0 ? 2*cutoff : sinf(2*M_PI*cutoff*t)/(M_PI*t);
+		float window = 0.42f - 0.5f*cosf(2*M_PI*i/(taps - 1)) + 0.08f*cosf(4*M_PI*i/(taps - 1));
+		dsp->filter[i] = sinc*window;
+		sum += dsp->filter[i];
+	}
+
+	// unity gain at 0 Hz, the padding up to filter_size stays zero
+	for (int i = 0; i < taps; ++i) dsp->filter[i] /= sum;
+}
+
+static void destroy_transform(struct wav_dsp *dsp) {
+	if (dsp->plan != NULL) fftwf_destroy_plan(dsp->plan);
+	free(dsp->history);
+	free(dsp->filter);
+	free(dsp->fft);
+	free(dsp->samples);
+	dsp->plan = NULL;
+	dsp->history = dsp->filter = dsp->samples = NULL;
+	dsp->fft = NULL;
+}
+
+// allocates and plans everything that depends on the decimation, leaving dsp untouched on failure
+// with FFTW_WISDOM_ONLY, falls back to an estimated plan when nothing was learnt about the size
+static bool create_transform(struct wav_dsp *dsp, int spectrum_size, unsigned plan_flags) {
+	struct wav_dsp next = *dsp;
+	size_t stream_count = dsp->stream_count;
+	next.decimation = get_decimation(dsp, spectrum_size);
+	next.buf_size = dsp->rate/next.decimation/dsp->frequency_step;
+	int bins = next.buf_size/2 + 1;
+	next.samples = calloc(stream_count*next.buf_size, sizeof(*next.samples));
+	next.fft = calloc(stream_count*bins, sizeof(*next.fft));
+	next.plan = NULL;
+	if (next.samples != NULL && next.fft != NULL) {
+		// a single plan over every stream, so that each one added costs a transform and nothing more
+		next.plan = fftwf_plan_many_dft_r2c(1, &next.buf_size, dsp->stream_count,
+				next.samples, NULL, 1, next.buf_size, next.fft, NULL, 1, bins, plan_flags);
+		if (next.plan == NULL && (plan_flags & FFTW_WISDOM_ONLY)) {
+			next.plan = fftwf_plan_many_dft_r2c(1, &next.buf_size, dsp->stream_count,
+					next.samples, NULL, 1, next.buf_size, next.fft, NULL, 1, bins, FFTW_ESTIMATE);
+		}
+	}
+
+	int taps = 0;
+	next.filter_size = 0;
+	next.filter = next.history = NULL;
+	if (next.decimation > 1) {
+		// wide enough for the transition band, from the highest bin up to its mirror image at the decimated rate
+		float max_frequency = (spectrum_size + 1)*dsp->frequency_step;
+		float transition = ((float) dsp->rate/next.decimation - 2*max_frequency)/dsp->rate;
+		taps = ceilf(5.5f/transition);
+		next.filter_size = (taps + 7) & ~7;
+		next.filter = calloc(next.filter_size, sizeof(*next.filter));
+		next.history = calloc(stream_count*2*next.filter_size, sizeof(*next.history));
+	}
+
+	if (next.plan == NULL || (next.decimation > 1 && (next.filter == NULL || next.history == NULL))) {
+		destroy_transform(&next);
+		return false;
+	}
+
+	// planning may have scribbled over the samples
+	memset(next.samples, 0, stream_count*next.buf_size*sizeof(*next.samples));
+	if (next.decimation > 1) design_filter(&next, taps);
+
+	destroy_transform(dsp);
+	*dsp = next;
+	memset(dsp->streams, 0, stream_count*sizeof(*dsp->streams));
+	return true;
+}
+
+bool init_dsp(struct wav_dsp *dsp, int rate, int frequency_step, int spectrum_size, int stream_count,
+		bool decimate, unsigned plan_flags) {
+	*dsp = (struct wav_dsp) {
+		.rate = rate,
+		.frequency_step = frequency_step,
+		.spectrum_size = spectrum_size,
+		.stream_count = stream_count,
+		.decimate = decimate,
+		.plan_flags = plan_flags
+	};
+	if (spectrum_size > get_dsp_capacity(dsp)) {
+		fputs("Spectrum is larger than the transform\n", stderr);
+		return false;
+	}
+
+	dsp->loudness_weighting = calloc(spectrum_size, sizeof(*dsp->loudness_weighting));
+	dsp->spectrum = calloc((size_t) stream_count*spectrum_size, sizeof(*dsp->spectrum));
+	dsp->streams = calloc(stream_count, sizeof(*dsp->streams));
+	if (dsp->loudness_weighting == NULL || dsp->spectrum == NULL || dsp->streams == NULL ||
+			!create_transform(dsp, spectrum_size, plan_flags)) {
+		fputs("Failed to initialise audio analysis\n", stderr);
+		finish_dsp(dsp);
+		return false;
+	}
+
+	weigh_loudness(dsp, 0, spectrum_size);
+
+	return true;
+}
+
+void finish_dsp(struct wav_dsp *dsp) {
+	destroy_transform(dsp);
+	free(dsp->streams);
+	free(dsp->spectrum);
+	free(dsp->loudness_weighting);
+	dsp->spectrum = dsp->loudness_weighting = NULL;
+	dsp->streams = NULL;
+}
+
+bool resize_dsp(struct wav_dsp *dsp, int spectrum_size) {
+	if (spectrum_size > get_dsp_capacity(dsp)) {
+		fputs("Spectrum is larger than the transform\n", stderr);
+		return false;
+	}
+
+	// the buffers only ever grow, so that they stay large enough for the old spectrum if replanning fails
+	if (spectrum_size > dsp->spectrum_size) {
+		float *loudness_weighting = realloc(dsp->loudness_weighting, spectrum_size*sizeof(*loudness_weighting));
+		if (loudness_weighting != NULL) dsp->loudness_weighting = loudness_weighting;
+		float *spectrum = realloc(dsp->spectrum, (size_t) dsp->stream_count*spectrum_size*sizeof(*spectrum));
+		if (spectrum != NULL) dsp->spectrum = spectrum;
+		if (loudness_weighting == NULL || spectrum == NULL) {
+			fputs("Failed to resize audio analysis\n", stderr);
+			return false;
+		}
+	}
+
+	// a new decimation moves every bin slightly, so they are all weighed again. capture is held up
+	// while this runs, so the planner only reuses what it learnt at startup rather than measuring again
+	int weighed = dsp->spectrum_size;
+	if (get_decimation(dsp, spectrum_size) != dsp->decimation) {
+		if (!create_transform(dsp, spectrum_size, dsp->plan_flags | FFTW_WISDOM_ONLY)) {
+			fputs("Failed to resize audio analysis\n", stderr);
+			return false;
+		}
+		weighed = 0;
+	}
+
+	if (spectrum_size > weighed) weigh_loudness(dsp, weighed, spectrum_size);
+	if (spectrum_size != dsp->spectrum_size) {
+		// every stream's spectrum has moved
+		memset(dsp->spectrum, 0, (size_t) dsp->stream_count*spectrum_size*sizeof(*dsp->spectrum));
+	}
+	dsp->spectrum_size = spectrum_size;
+	return true;
+}
+
+// the common channel counts are written out so that the compiler can vectorise them
+static void convert_float32(float *restrict out, const float *restrict in, size_t frames, int channels) {
+	float scale = 1.0f/channels;
+	if (channels == 1) {
+		memcpy(out, in, frames*sizeof(*out));
+	} else if (channels == 2) {
+		for (size_t i = 0; i < frames; ++i) out[i] = (in[2*i] + in[2*i + 1])*scale;
+	} else {
+		for (size_t i = 0; i < frames; ++i) {
+			float sum = 0;
+			for (int c = 0; c < channels; ++c) sum += in[i*channels + c];
+			out[i] = sum*scale;
+		}
+	}
+}
+
+static void convert_s16(float *restrict out, const int16_t *restrict in, size_t frames, int channels) {
+	float scale = 1.0f/(32768.0f*channels);
+	if (channels == 1) {
+		for (size_t i = 0; i < frames; ++i) out[i] = in[i]*scale;
+	} else if (channels == 2) {
+		for (size_t i = 0; i < frames; ++i) out[i] = (in[2*i] + in[2*i + 1])*scale;
+	} else {
+		for (size_t i = 0; i < frames; ++i) {
+			int32_t sum = 0;
+			for (int c = 0; c < channels; ++c) sum += in[i*channels + c];
+			out[i] = sum*scale;
+		}
+	}
+}
+
+// shift is 8 for 24 bit samples, to move their sign into the top bit
+static void convert_s32(float *restrict out, const int32_t *restrict in, size_t frames, int channels, int shift) {
+	float scale = 1.0f/(2147483648.0f*channels);
+	if (channels == 1) {
+		for (size_t i = 0; i < frames; ++i) out[i] = (float) (int32_t) ((uint32_t) in[i] << shift)*scale;
+	} else if (channels == 2) {
+		for (size_t i = 0; i < frames; ++i) {
+			out[i] = ((float) (int32_t) ((uint32_t) in[2*i] << shift) +
+					(float) (int32_t) ((uint32_t) in[2*i + 1] << shift))*scale;
+		}
+	} else {
+		for (size_t i = 0; i < frames; ++i) {
+			float sum = 0;
+			for (int c = 0; c < channels; ++c) sum += (float) (int32_t) ((uint32_t) in[i*channels + c] << shift);
+			out[i] = sum*scale;
+		}
+	}
+}
+
+void convert_dsp_samples(float *restrict out, const void *restrict in, size_t frames,
+		enum wav_sample_format format, int channels) {
+	switch (format) {
+		case WAV_SAMPLE_FLOAT32: convert_float32(out, in, frames, channels); break;
+		case WAV_SAMPLE_S16: convert_s16(out, in, frames, channels); break;
+		case WAV_SAMPLE_S24_32: convert_s32(out, in, frames, channels, 8); break;
+		case WAV_SAMPLE_S32: convert_s32(out, in, frames, channels, 0); break;
+	}
+}
+
+// eight independent sums, so that the loop vectorises without reassociating any of them
+static float dot_product(const float *restrict a, const float *restrict b, int size) {
+	float sums[8] = {0};
+	for (int i = 0; i < size; i += 8) {
+		for (int j = 0; j < 8; ++j) sums[j] += a[i + j]*b[i + j];
+	}
+	return ((sums[0] + sums[4]) + (sums[1] + sums[5])) + ((sums[2] + sums[6]) + (sums[3] + sums[7]));
+}
+
+// the filter is only evaluated for the samples that are kept, which costs as much as a polyphase filter bank
+static void push_decimated_samples(struct wav_dsp *dsp, int stream, const float *samples, size_t count) {
+	struct wav_dsp_stream *state = &dsp->streams[stream];
+	float *window = dsp->samples + (size_t) stream*dsp->buf_size;
+	float *history = dsp->history + (size_t) stream*2*dsp->filter_size;
+	size_t kept = (state->phase + count)/dsp->decimation;
+	size_t shift = kept < (size_t) dsp->buf_size ? kept : (size_t) dsp->buf_size;
+	memmove(window, window + shift, (dsp->buf_size - shift)*sizeof(*window));
+
+	// samples that would be pushed straight back out of the window are only added to the history
+	ptrdiff_t out = (ptrdiff_t) dsp->buf_size - (ptrdiff_t) kept;
+	int size = dsp->filter_size, pos = state->history_pos, phase = state->phase;
+	for (size_t i = 0; i < count; ++i) {
+		history[pos] = history[pos + size] = samples[i];
+		if (++pos == size) pos = 0;
+		if (++phase < dsp->decimation) continue;
+
+		phase = 0;
+		if (out >= 0) window[out] = dot_product(dsp->filter, history + pos, size);
+		++out;
+	}
+	state->history_pos = pos;
+	state->phase = phase;
+}
+
+void push_dsp_samples(struct wav_dsp *dsp, int stream, const float *samples, size_t count) {
+	if (dsp->decimation > 1) {
+		push_decimated_samples(dsp, stream, samples, count);
+		return;
+	}
+
+	float *window = dsp->samples + (size_t) stream*dsp->buf_size;
+	int old_size = dsp->buf_size - (int) count;
+	if (old_size > 0) {
+		memmove(window, window + count, old_size*sizeof(*window));
+		memcpy(window + old_size, samples, count*sizeof(*window));
+	} else {
+		memcpy(window, samples - old_size, dsp->buf_size*sizeof(*window));
+	}
+}
+
+void reset_dsp(struct wav_dsp *dsp) {
+	size_t stream_count = dsp->stream_count;
+	memset(dsp->samples, 0, stream_count*dsp->buf_size*sizeof(*dsp->samples));
+	if (dsp->history != NULL) memset(dsp->history, 0, stream_count*2*dsp->filter_size*sizeof(*dsp->history));
+	memset(dsp->streams, 0, stream_count*sizeof(*dsp->streams));
+}
+
+bool is_dsp_silent(const struct wav_dsp *dsp, int stream) {
+	const float *window = dsp->samples + (size_t) stream*dsp->buf_size;
+	for (int i = 0; i < dsp->buf_size; ++i) {
+		if (window[i] != 0) return false;
+	}
+	return true;
+}
+
+float run_dsp(struct wav_dsp *dsp) {
+	fftwf_execute(dsp->plan);
+
+	// skip the 0 Hz bin
+	int bins = dsp->buf_size/2 + 1;
+	float max_amplitude = 0;
+	for (int stream = 0; stream < dsp->stream_count; ++stream) {
+		const fftwf_complex *fft = dsp->fft + (size_t) stream*bins;
+		float *spectrum = get_dsp_spectrum(dsp, stream);
+		for (int i = 0; i < dsp->spectrum_size; ++i) {
+			float amplitude = cbrtf(cabsf(fft[i + 1]))*dsp->loudness_weighting[i];
+			spectrum[i] = amplitude;
+			if (amplitude > max_amplitude) max_amplitude = amplitude;
+		}
+	}
+	return max_amplitude;
+}
+
+int64_t get_dsp_time(void) {
+	struct timespec timestamp;
+	clock_gettime(CLOCK_MONOTONIC, &timestamp);
+	return 1000000000*(int64_t) timestamp.tv_sec + timestamp.tv_nsec;
+}
+
+// longer gaps are silence or a pause, and the older spectrum has nothing to do with the new one
+#define MAX_INTERPOLATION_INTERVAL 100000000
+
+bool init_peaks(struct wav_peaks *peaks, int size, float diminish_rate, bool interpolated) {
+	peaks->size = size;
+	peaks->diminish_rate = diminish_rate;
+	peaks->peak = calloc(size, sizeof(*peaks->peak));
+	peaks->peak_time = calloc(size, sizeof(*peaks->peak_time));
+	atomic_init(&peaks->max_key, 0);
+
+	peaks->interpolated = interpolated;
+	atomic_init(&peaks->sequence, 0);
+	peaks->latest = 0;
+	peaks->history_time[0] = peaks->history_time[1] = 0;
+	peaks->history[0] = peaks->history[1] = peaks->spectrum = NULL;
+	if (interpolated) {
+		peaks->history[0] = calloc(size, sizeof(*peaks->history[0]));
+		peaks->history[1] = calloc(size, sizeof(*peaks->history[1]));
+		peaks->spectrum = calloc(size, sizeof(*peaks->spectrum));
+	}
+
+	if (peaks->peak == NULL || peaks->peak_time == NULL || (interpolated &&
+			(peaks->history[0] == NULL || peaks->history[1] == NULL || peaks->spectrum == NULL))) {
+		fputs("Failed to allocate memory for peaks\n", stderr);
+		finish_peaks(peaks);
+		return false;
+	}
+	return true;
+}
+
+void finish_peaks(struct wav_peaks *peaks) {
+	free(peaks->peak_time);
+	free(peaks->peak);
+	free(peaks->history[0]);
+	free(peaks->history[1]);
+	free(peaks->spectrum);
+	peaks->peak_time = NULL;
+	peaks->peak = NULL;
+	peaks->history[0] = peaks->history[1] = peaks->spectrum = NULL;
+}
+
+static bool resize_values(float **values, int old_size, int size) {
+	float *resized = realloc(*values, (size > 0 ? size : 1)*sizeof(*resized));
+	if (resized == NULL) return false;
+	for (int i = old_size; i < size; ++i) resized[i] = 0;
+	*values = resized;
+	return true;
+}
+
+bool resize_peaks(struct wav_peaks *peaks, int size) {
+	size_t count = size > 0 ? size : 1;
+	_Atomic(float) *peak = realloc(peaks->peak, count*sizeof(*peak));
+	if (peak != NULL) peaks->peak = peak;
+	_Atomic(int64_t) *peak_time = realloc(peaks->peak_time, count*sizeof(*peak_time));
+	if (peak_time != NULL) peaks->peak_time = peak_time;
+	bool resized = peak != NULL && peak_time != NULL;
+	if (resized && peaks->interpolated) {
+		resized = resize_values(&peaks->history[0], peaks->size, size) &&
+			resize_values(&peaks->history[1], peaks->size, size) &&
+			resize_values(&peaks->spectrum, peaks->size, size);
+	}
+	if (!resized) {
+		fputs("Failed to allocate memory for peaks\n", stderr);
+		return false;
+	}
+
+	for (int i = peaks->size; i < size; ++i) {
+		atomic_init(&peak[i], 0);
+		atomic_init(&peak_time[i], 0);
+	}
+
+	// the highest peak may have been in one of the bins that were dropped
+	double max_key = 0;
+	for (int i = 0; i < size; ++i) {
+		double key = atomic_load_explicit(&peak[i], memory_order_relaxed) +
+			atomic_load_explicit(&peak_time[i], memory_order_relaxed)*1e-9*peaks->diminish_rate;
+		if (key > max_key) max_key = key;
+	}
+	atomic_store_explicit(&peaks->max_key, max_key, memory_order_relaxed);
+	peaks->size = size;
+	return true;
+}
+
+static void raise_peaks(struct wav_peaks *peaks, const float *spectrum, int64_t time) {
+	double decay = time*1e-9*peaks->diminish_rate;
+	double max_key = atomic_load_explicit(&peaks->max_key, memory_order_relaxed);
+	for (int i = 0; i < peaks->size; ++i) {
+		if (spectrum[i] <= sample_peak(peaks, i, time)) continue;
+
+		atomic_store_explicit(&peaks->peak[i], spectrum[i], memory_order_relaxed);
+		atomic_store_explicit(&peaks->peak_time[i], time, memory_order_relaxed);
+		if (spectrum[i] + decay > max_key) max_key = spectrum[i] + decay;
+	}
+	atomic_store_explicit(&peaks->max_key, max_key, memory_order_relaxed);
+}
+
+void update_peaks(struct wav_peaks *peaks, const float *spectrum, int64_t time) {
+	unsigned sequence = atomic_load_explicit(&peaks->sequence, memory_order_relaxed);
+	if (!peaks->interpolated) {
+		raise_peaks(peaks, spectrum, time);
+		atomic_store_explicit(&peaks->sequence, sequence + 2, memory_order_release);
+		return;
+	}
+
+	// the older spectrum is overwritten, so that the pair is always the last two
+	atomic_store_explicit(&peaks->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	int older = 1 - peaks->latest;
+	memcpy(peaks->history[older], spectrum, peaks->size*sizeof(*spectrum));
+	peaks->history_time[older] = time;
+	peaks->latest = older;
+
+	atomic_store_explicit(&peaks->sequence, sequence + 2, memory_order_release);
+}
+
+// the spectrum one interval after the latest is the latest itself, and halfway is halfway between the two.
+// past that it carries on along the same line for one more interval, in case the next spectrum is late.
+// returns false if there is nothing to raise the peaks to
+static bool interpolate_peaks(struct wav_peaks *peaks, int64_t time) {
+	const float *latest = peaks->history[peaks->latest], *previous = peaks->history[1 - peaks->latest];
+	int64_t latest_time = peaks->history_time[peaks->latest];
+	int64_t interval = latest_time - peaks->history_time[1 - peaks->latest];
+	if (latest_time == 0 || time - latest_time > 2*MAX_INTERPOLATION_INTERVAL) return false;
+	if (interval <= 0 || interval > MAX_INTERPOLATION_INTERVAL) {
+		memcpy(peaks->spectrum, latest, peaks->size*sizeof(*latest));
+		return true;
+	}
+
+	float t = (float) (time - latest_time)/interval;
+	if (t > 2) return false; // the peaks are left to fall from here
+	if (t < 0) t = 0;
+	for (int i = 0; i < peaks->size; ++i) {
+		float value = previous[i] + t*(latest[i] - previous[i]);
+		peaks->spectrum[i] = value > 0 ? value : 0;
+	}
+	return true;
+}
+
+void advance_peaks(struct wav_peaks *peaks, int64_t time) {
+	if (!peaks->interpolated) return;
+
+	bool found = false;
+	unsigned sequence;
+	do {
+		sequence = atomic_load_explicit(&peaks->sequence, memory_order_acquire);
+		if (sequence & 1) continue; // a spectrum is being stored
+		found = interpolate_peaks(peaks, time);
+		atomic_thread_fence(memory_order_acquire);
+	} while ((sequence & 1) || atomic_load_explicit(&peaks->sequence, memory_order_relaxed) != sequence);
+
+	if (found) raise_peaks(peaks, peaks->spectrum, time);
+}
@@ -2,12 +2,16 @@
 
 #include "config.h"
 #include "event-loop.h"
+#include "mainloop.h"
+#include "output.h"
 #include "render.h"
+#include "text.h"
 #include "wav.h"
 
 #include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <sys/resource.h>
 #include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
@@ -15,34 +19,48 @@
 enum wav_events {
 	WAV_WAYLAND_EVENT,
 	WAV_AUDIO_EVENT,
+	WAV_TEXT_EVENT,
+	WAV_VISIBILITY_EVENT,
 	WAV_EVENT_COUNT
 };
 
-void run_event_loop(struct wav_state *state) {
+// pulseaudio runs on its own thread and wakes this one through state->audiofd
+static void run_threaded_event_loop(struct wav_state *state) {
+	// poll() skips negative file descriptors, so whichever of wayland and text is unused is left out
 	struct pollfd events[] = {
 		[WAV_WAYLAND_EVENT] = (struct pollfd) {
-			.fd = wl_display_get_fd(state->display),
+			.fd = state->display != NULL ? wl_display_get_fd(state->display) : -1,
 			.events = POLLIN
 		},
 		[WAV_AUDIO_EVENT] = (struct pollfd) {
 			.fd = state->audiofd,
 			.events = POLLIN
+		},
+		[WAV_TEXT_EVENT] = (struct pollfd) {
+			.fd = state->text != NULL ? state->text->timerfd : -1,
+			.events = POLLIN
+		},
+		[WAV_VISIBILITY_EVENT] = (struct pollfd) {
+			.fd = state->display != NULL ? state->visibilityfd : -1,
+			.events = POLLIN
 		}
 	};
 
 	int polled = 0;
-	state->running = true;
-	while (state->running) {
-		while (wl_display_prepare_read(state->display) != 0) {
-			wl_display_dispatch_pending(state->display);
+	while (atomic_load_explicit(&state->running, memory_order_relaxed)) {
+		if (state->display != NULL) {
+			while (wl_display_prepare_read(state->display) != 0) {
+				wl_display_dispatch_pending(state->display);
+			}
+			wl_display_flush(state->display);
 		}
-		wl_display_flush(state->display);
 
 		polled =  poll(events, WAV_EVENT_COUNT, -1);
 		if (polled < 0) {
-			wl_display_cancel_read(state->display);
+			if (state->display != NULL) wl_display_cancel_read(state->display);
 			break;
 		}
+		++state->wakeups;
 
 		// read wayland events
 		if (events[WAV_WAYLAND_EVENT].revents & POLLIN) {
@@ -50,10 +68,13 @@ void run_event_loop(struct wav_state *state) {
 				fputs("Failed to process wayland event\n", stderr);
 				break;
 			}
-		} else {
+		} else if (state->display != NULL) {
 			wl_display_cancel_read(state->display);
 		}
 
+		if (events[WAV_TEXT_EVENT].revents & POLLIN) handle_text_tick(state);
+		if (events[WAV_VISIBILITY_EVENT].revents & POLLIN) check_visibility(state);
+
 		// read audio events
 		if (events[WAV_AUDIO_EVENT].revents & POLLIN) {
 			uint64_t signal;
@@ -62,7 +83,106 @@ void run_event_loop(struct wav_state *state) {
 				fputs("Failed to process audio event\n", stderr);
 				break;
 			}
-			if (!state->frame_scheduled) render_frame(state);
+			render_frame(state);
 		}
 	}
 }
+
+struct wayland_source {
+	struct wav_state *state;
+	bool read;
+};
+
+static void read_wayland_events(pa_mainloop_api *api, pa_io_event *event, int fd,
+		pa_io_event_flags_t events, void *data) {
+	struct wayland_source *source = data;
+	source->read = true;
+	if (wl_display_read_events(source->state->display) != 0) {
+		fputs("Failed to process wayland event\n", stderr);
+		atomic_store(&source->state->running, false);
+	}
+}
+
+// only used when a separate analysis thread produces the spectrum
+static void read_audio_events(pa_mainloop_api *api, pa_io_event *event, int fd,
+		pa_io_event_flags_t events, void *data) {
+	struct wav_state *state = data;
+	uint64_t signal;
+	if (read(fd, &signal, sizeof(signal)) < 0) {
+		fputs("Failed to process audio event\n", stderr);
+		atomic_store(&state->running, false);
+		return;
+	}
+	render_frame(state);
+}
+
+static void read_text_events(pa_mainloop_api *api, pa_io_event *event, int fd,
+		pa_io_event_flags_t events, void *data) {
+	handle_text_tick(data);
+}
+
+static void read_visibility_events(pa_mainloop_api *api, pa_io_event *event, int fd,
+		pa_io_event_flags_t events, void *data) {
+	check_visibility(data);
+}
+
+// pulseaudio and wayland (or text) are all dispatched from the same epoll instance, and audio renders directly
+static void run_single_threaded_event_loop(struct wav_state *state) {
+	struct wayland_source source = { .state = state };
+	pa_mainloop_api *api = get_mainloop_api(state->mainloop);
+	pa_io_event *display_event = state->display != NULL ?
+		api->io_new(api, wl_display_get_fd(state->display), PA_IO_EVENT_INPUT, read_wayland_events, &source) :
+		api->io_new(api, state->text->timerfd, PA_IO_EVENT_INPUT, read_text_events, state);
+	pa_io_event *audio_event = api->io_new(api, state->audiofd, PA_IO_EVENT_INPUT, read_audio_events, state);
+	pa_io_event *visibility_event = state->display != NULL ?
+		api->io_new(api, state->visibilityfd, PA_IO_EVENT_INPUT, read_visibility_events, state) : NULL;
+	if (display_event == NULL || audio_event == NULL || (state->display != NULL && visibility_event == NULL)) return;
+
+	while (atomic_load_explicit(&state->running, memory_order_relaxed)) {
+		if (state->display != NULL) {
+			while (wl_display_prepare_read(state->display) != 0) {
+				wl_display_dispatch_pending(state->display);
+			}
+			wl_display_flush(state->display);
+		}
+
+		source.read = false;
+		if (iterate_mainloop(state->mainloop) < 0) {
+			if (!source.read && state->display != NULL) wl_display_cancel_read(state->display);
+			break;
+		}
+		++state->wakeups;
+
+		if (!source.read && state->display != NULL) wl_display_cancel_read(state->display);
+	}
+
+	if (visibility_event != NULL) api->io_free(visibility_event);
+	api->io_free(audio_event);
+	api->io_free(display_event);
+}
+
+void run_event_loop(struct wav_state *state) {
+	atomic_store(&state->running, true);
+	if (state->mainloop != NULL) run_single_threaded_event_loop(state);
+	else run_threaded_event_loop(state);
+}
+
+void print_event_loop_stats(struct wav_state *state) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(stderr, "Event loop: %s\n", state->mainloop != NULL ? "single threaded" : "threaded");
+	fprintf(stderr, "Main thread wakeups: %lu\n", state->wakeups);
+	fprintf(stderr, "Context switches: %ld voluntary, %ld involuntary\n", usage.ru_nvcsw, usage.ru_nivcsw);
+
+	static const char *quality_names[WAV_QUALITY_COUNT] = {
+		[WAV_QUALITY_FULL] = "full",
+		[WAV_QUALITY_NO_CORNERS] = "no corners",
+		[WAV_QUALITY_HALF_RESOLUTION] = "half resolution"
+	};
+	if (state->display == NULL) return;
+	struct wav_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		fprintf(stderr, "Output %u: %s quality, %.2f ms per frame, %lu quality changes\n", output->name,
+				quality_names[output->quality], output->frame_cost/1e6, output->quality_changes);
+	}
+}
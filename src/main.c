@@ -3,6 +3,8 @@
 #include "audio.h"
 #include "config.h"
 #include "event-loop.h"
+#include "text.h"
+#include "trace.h"
 #include "wav.h"
 #include "wayland.h"
 
@@ -11,35 +13,100 @@
 #include <stdlib.h>
 #include <time.h>
 
-// static const char *usage =
+static const char *usage =
+	"Usage: wav [options]\n"
+	"\n"
+	"  -h, --help                   Show this help message and exit\n"
+	"  -A, --source <name>          Capture from this source, e.g. @DEFAULT_MONITOR@, may be repeated\n"
+	"                               for outputs to show each in turn\n"
+	"  -f, --frequency-step <hz>    Frequency range covered by each bar\n"
+	"  -D, --decimate               Analyse at the lowest sample rate that covers every bar\n"
+	"  -i, --interpolated           Move the bars smoothly between spectra, one spectrum behind\n"
+	"  -H, --height <px>            Maximum height of the bars\n"
+	"  -m, --margin <px>            Margin on either side of each bar\n"
+	"  -w, --width <px>             Width of each bar\n"
+	"  -r, --roundness <n>          Corner radius, in multiples of the bar height\n"
+	"  -s, --render-scale <n>       Render at 1/n of the output resolution\n"
+	"  -b, --frame-budget <us>      Lower the quality while frames take longer than this to draw\n"
+	"  -W, --waveform               Draw the waveform instead of the spectrum\n"
+	"  -L, --waterfall              Draw a scrolling spectrogram over the whole output\n"
+	"  -c, --color <colors>         Bar colours as #rrggbb or #aarrggbb, comma separated\n"
+	"  -g, --gradient <colors>      Blend between these colours from base to tip\n"
+	"  -p, --pixel-format <format>  Buffer format: argb8888, argb4444 or argb1555\n"
+	"  -T, --text <columns>         Draw to the terminal instead of the outputs\n"
+	"  -B, --swaybar                With --text, draw as a swaybar status command\n"
+	"  -e, --export <name>          Publish the spectrum to a shared memory segment\n"
+	"  -t, --record <file>          Record every analysed spectrum to a trace file\n"
+	"  -q, --quantise               Record magnitudes as 16-bit integers\n"
+	"  -P, --replay <file>          Render a recorded trace instead of capturing audio\n"
+	"  -F, --replay-fast            Replay as fast as possible, ignoring the recorded timing\n"
+	"  -S, --single-thread          Run pulseaudio on the main thread\n"
+	"  -a, --analysis-thread        Run the FFT on a dedicated thread\n"
+	"  -C, --analysis-cpus <list>   Pin the analysis thread to these CPUs\n"
+	"  -R, --analysis-priority <n>  Run the analysis thread with SCHED_FIFO\n"
+	"  -N, --analysis-nice <n>      Nice value of the analysis thread\n"
+	"  -V, --stats                  Print event loop statistics on exit\n";
 
 static struct wav_state state = {0};
 
 static void handle_signal(int signum) {
-	state.running = false;
+	atomic_store(&state.running, false);
 }
 
 int main(int argc, char **argv) {
 	init_default_config(&state.config);
-	/*switch (parse_config(&state.config, argc, argv)) {
+	switch (parse_config(&state.config, argc, argv)) {
 		case 1:
-			printf(usage);
+			fputs(usage, stdout);
 			return EXIT_SUCCESS;
 		case -1: return EXIT_FAILURE;
 	} // ignore 0
-*/
 
-	if (!init_wayland(&state)) return EXIT_FAILURE;
-	if (!init_audio(&state)) return EXIT_FAILURE;
+	if (state.config.waveform && (state.config.text_columns > 0 || state.config.replay_name != NULL)) {
+		fputs("Warning: the waveform is only drawn from live audio on outputs, drawing the spectrum\n", stderr);
+		state.config.waveform = false;
+	}
+	if (state.config.waveform && state.config.waterfall) {
+		fputs("Warning: the waterfall is a spectrogram, drawing the waveform instead\n", stderr);
+		state.config.waterfall = false;
+	}
+	if (state.config.waveform && (state.config.export_name != NULL || state.config.record_name != NULL)) {
+		fputs("Warning: the spectrum is neither exported nor recorded while drawing the waveform\n", stderr);
+		state.config.export_name = state.config.record_name = NULL;
+	}
+
+	if (state.config.source_count > 0 && state.config.replay_name != NULL) {
+		fputs("Warning: sources are ignored while replaying\n", stderr);
+		state.config.source_count = 0;
+	}
+	if (state.config.source_count > 1 && (state.config.waveform || state.config.text_columns > 0)) {
+		fputs("Warning: the waveform and text only show one source, using the first\n", stderr);
+		state.config.source_count = 1;
+	}
+
+	if (state.config.text_columns > 0) {
+		if (!init_text(&state)) return EXIT_FAILURE;
+	} else if (!init_wayland(&state)) {
+		return EXIT_FAILURE;
+	}
+	if (state.config.replay_name != NULL) {
+		if (state.config.export_name != NULL) fputs("Warning: spectrum is not exported while replaying\n", stderr);
+		if (!start_replay(&state)) return EXIT_FAILURE;
+	} else if (!init_audio(&state)) {
+		return EXIT_FAILURE;
+	}
 
 	struct sigaction sa = { .sa_handler = handle_signal };
 	sigaction(SIGINT, &sa, NULL);
 	sigaction(SIGTERM, &sa, NULL);
 
 	run_event_loop(&state);
+	if (state.config.print_stats) print_event_loop_stats(&state);
 
-	finish_audio(&state);
-	finish_wayland(&state);
+	if (state.replay != NULL) stop_replay(&state);
+	else finish_audio(&state);
+	if (state.text != NULL) finish_text(&state);
+	else finish_wayland(&state);
 //	finish_config(&state.config);
 
 	return EXIT_SUCCESS;
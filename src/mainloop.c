@@ -0,0 +1,339 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "mainloop.h"
+
+#include <pulse/pulseaudio.h>
+#include <wayland-util.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+// libpulse sets this bit in tv_usec for times on its monotonic clock rather than the wall clock
+#define PA_TIMEVAL_RTCLOCK (1U << 30)
+
+#define MAX_EPOLL_EVENTS 16
+
+struct wav_mainloop {
+	pa_mainloop_api api;
+	int epollfd;
+
+	struct wl_list io_events; // pa_io_event::link
+	struct wl_list time_events; // pa_time_event::link
+	struct wl_list defer_events; // pa_defer_event::link
+	int enabled_defer_count;
+	bool has_dead_events;
+};
+
+struct pa_io_event {
+	struct wav_mainloop *loop;
+	struct wl_list link;
+	bool dead;
+
+	int fd;
+	pa_io_event_cb_t callback;
+	pa_io_event_destroy_cb_t destroy_callback;
+	void *userdata;
+};
+
+struct pa_time_event {
+	struct wav_mainloop *loop;
+	struct wl_list link;
+	bool dead;
+
+	bool enabled;
+	int64_t deadline; // CLOCK_MONOTONIC, in nanoseconds
+	struct timeval time; // as given, to be passed back to the callback
+	pa_time_event_cb_t callback;
+	pa_time_event_destroy_cb_t destroy_callback;
+	void *userdata;
+};
+
+struct pa_defer_event {
+	struct wav_mainloop *loop;
+	struct wl_list link;
+	bool dead;
+
+	bool enabled;
+	pa_defer_event_cb_t callback;
+	pa_defer_event_destroy_cb_t destroy_callback;
+	void *userdata;
+};
+
+static int64_t get_time(clockid_t clock) {
+	struct timespec timestamp;
+	clock_gettime(clock, &timestamp);
+	return 1000000000*(int64_t) timestamp.tv_sec + timestamp.tv_nsec;
+}
+
+static int64_t get_deadline(const struct timeval *tv) {
+	if (tv->tv_usec & PA_TIMEVAL_RTCLOCK) {
+		return 1000000000*(int64_t) tv->tv_sec + 1000*(int64_t) (tv->tv_usec & ~PA_TIMEVAL_RTCLOCK);
+	}
+
+	// wall clock time, convert to the monotonic clock
+	int64_t wall_time = 1000000000*(int64_t) tv->tv_sec + 1000*(int64_t) tv->tv_usec;
+	return get_time(CLOCK_MONOTONIC) + wall_time - get_time(CLOCK_REALTIME);
+}
+
+static uint32_t to_epoll_events(pa_io_event_flags_t events) {
+	return (events & PA_IO_EVENT_INPUT ? EPOLLIN : 0) |
+		(events & PA_IO_EVENT_OUTPUT ? EPOLLOUT : 0) |
+		(events & PA_IO_EVENT_HANGUP ? EPOLLHUP : 0) |
+		(events & PA_IO_EVENT_ERROR ? EPOLLERR : 0);
+}
+
+static pa_io_event_flags_t from_epoll_events(uint32_t events) {
+	return (events & EPOLLIN ? PA_IO_EVENT_INPUT : 0) |
+		(events & EPOLLOUT ? PA_IO_EVENT_OUTPUT : 0) |
+		(events & EPOLLHUP ? PA_IO_EVENT_HANGUP : 0) |
+		(events & EPOLLERR ? PA_IO_EVENT_ERROR : 0);
+}
+
+static pa_io_event *io_new(pa_mainloop_api *api, int fd, pa_io_event_flags_t events,
+		pa_io_event_cb_t callback, void *userdata) {
+	struct wav_mainloop *loop = api->userdata;
+	pa_io_event *event = calloc(1, sizeof(*event));
+	if (event == NULL) return NULL;
+
+	event->loop = loop;
+	event->fd = fd;
+	event->callback = callback;
+	event->userdata = userdata;
+
+	struct epoll_event epoll_event = {
+		.events = to_epoll_events(events),
+		.data.ptr = event
+	};
+	if (epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, fd, &epoll_event) == -1) {
+		fputs("Failed to add file descriptor to event loop\n", stderr);
+		free(event);
+		return NULL;
+	}
+
+	wl_list_insert(&loop->io_events, &event->link);
+	return event;
+}
+
+static void io_enable(pa_io_event *event, pa_io_event_flags_t events) {
+	struct epoll_event epoll_event = {
+		.events = to_epoll_events(events),
+		.data.ptr = event
+	};
+	epoll_ctl(event->loop->epollfd, EPOLL_CTL_MOD, event->fd, &epoll_event);
+}
+
+static void io_free(pa_io_event *event) {
+	epoll_ctl(event->loop->epollfd, EPOLL_CTL_DEL, event->fd, NULL);
+	event->dead = true;
+	event->loop->has_dead_events = true;
+}
+
+static void io_set_destroy(pa_io_event *event, pa_io_event_destroy_cb_t callback) {
+	event->destroy_callback = callback;
+}
+
+static void time_restart(pa_time_event *event, const struct timeval *tv) {
+	event->enabled = tv != NULL;
+	if (tv != NULL) {
+		event->time = *tv;
+		event->deadline = get_deadline(tv);
+	}
+}
+
+static pa_time_event *time_new(pa_mainloop_api *api, const struct timeval *tv,
+		pa_time_event_cb_t callback, void *userdata) {
+	struct wav_mainloop *loop = api->userdata;
+	pa_time_event *event = calloc(1, sizeof(*event));
+	if (event == NULL) return NULL;
+
+	event->loop = loop;
+	event->callback = callback;
+	event->userdata = userdata;
+	time_restart(event, tv);
+
+	wl_list_insert(&loop->time_events, &event->link);
+	return event;
+}
+
+static void time_free(pa_time_event *event) {
+	event->dead = true;
+	event->enabled = false;
+	event->loop->has_dead_events = true;
+}
+
+static void time_set_destroy(pa_time_event *event, pa_time_event_destroy_cb_t callback) {
+	event->destroy_callback = callback;
+}
+
+static pa_defer_event *defer_new(pa_mainloop_api *api, pa_defer_event_cb_t callback, void *userdata) {
+	struct wav_mainloop *loop = api->userdata;
+	pa_defer_event *event = calloc(1, sizeof(*event));
+	if (event == NULL) return NULL;
+
+	event->loop = loop;
+	event->enabled = true;
+	event->callback = callback;
+	event->userdata = userdata;
+	++loop->enabled_defer_count;
+
+	wl_list_insert(&loop->defer_events, &event->link);
+	return event;
+}
+
+static void defer_enable(pa_defer_event *event, int enable) {
+	if (event->enabled == !!enable) return;
+	event->enabled = enable;
+	event->loop->enabled_defer_count += enable ? 1 : -1;
+}
+
+static void defer_free(pa_defer_event *event) {
+	defer_enable(event, false);
+	event->dead = true;
+	event->loop->has_dead_events = true;
+}
+
+static void defer_set_destroy(pa_defer_event *event, pa_defer_event_destroy_cb_t callback) {
+	event->destroy_callback = callback;
+}
+
+static void quit(pa_mainloop_api *api, int retval) {
+	// the loop is owned by the event loop, which has its own notion of running
+}
+
+struct wav_mainloop *create_mainloop(void) {
+	struct wav_mainloop *loop = calloc(1, sizeof(*loop));
+	if (loop == NULL) {
+		fputs("Failed to allocate memory for event loop\n", stderr);
+		return NULL;
+	}
+
+	loop->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epollfd == -1) {
+		fputs("Failed to create epoll instance\n", stderr);
+		free(loop);
+		return NULL;
+	}
+
+	wl_list_init(&loop->io_events);
+	wl_list_init(&loop->time_events);
+	wl_list_init(&loop->defer_events);
+
+	loop->api = (pa_mainloop_api) {
+		.userdata = loop,
+		.io_new = io_new,
+		.io_enable = io_enable,
+		.io_free = io_free,
+		.io_set_destroy = io_set_destroy,
+		.time_new = time_new,
+		.time_restart = time_restart,
+		.time_free = time_free,
+		.time_set_destroy = time_set_destroy,
+		.defer_new = defer_new,
+		.defer_enable = defer_enable,
+		.defer_free = defer_free,
+		.defer_set_destroy = defer_set_destroy,
+		.quit = quit
+	};
+
+	return loop;
+}
+
+static void collect_dead_events(struct wav_mainloop *loop, bool all) {
+	pa_mainloop_api *api = &loop->api;
+
+	pa_io_event *io_event, *io_tmp;
+	wl_list_for_each_safe(io_event, io_tmp, &loop->io_events, link) {
+		if (!io_event->dead && !all) continue;
+		if (!io_event->dead) epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, io_event->fd, NULL);
+		if (io_event->destroy_callback) io_event->destroy_callback(api, io_event, io_event->userdata);
+		wl_list_remove(&io_event->link);
+		free(io_event);
+	}
+
+	pa_time_event *time_event, *time_tmp;
+	wl_list_for_each_safe(time_event, time_tmp, &loop->time_events, link) {
+		if (!time_event->dead && !all) continue;
+		if (time_event->destroy_callback) time_event->destroy_callback(api, time_event, time_event->userdata);
+		wl_list_remove(&time_event->link);
+		free(time_event);
+	}
+
+	pa_defer_event *defer_event, *defer_tmp;
+	wl_list_for_each_safe(defer_event, defer_tmp, &loop->defer_events, link) {
+		if (!defer_event->dead && !all) continue;
+		if (defer_event->destroy_callback) defer_event->destroy_callback(api, defer_event, defer_event->userdata);
+		wl_list_remove(&defer_event->link);
+		free(defer_event);
+	}
+
+	loop->has_dead_events = false;
+}
+
+void destroy_mainloop(struct wav_mainloop *loop) {
+	collect_dead_events(loop, true);
+	close(loop->epollfd);
+	free(loop);
+}
+
+pa_mainloop_api *get_mainloop_api(struct wav_mainloop *loop) {
+	return &loop->api;
+}
+
+static int get_timeout(struct wav_mainloop *loop) {
+	if (loop->enabled_defer_count > 0) return 0;
+
+	bool found = false;
+	int64_t deadline = 0;
+	pa_time_event *event;
+	wl_list_for_each(event, &loop->time_events, link) {
+		if (!event->enabled) continue;
+		if (!found || event->deadline < deadline) deadline = event->deadline;
+		found = true;
+	}
+	if (!found) return -1;
+
+	// round up, so that the timer has expired by the time epoll returns
+	int64_t remaining = deadline - get_time(CLOCK_MONOTONIC);
+	return remaining > 0 ? (remaining + 999999)/1000000 : 0;
+}
+
+int iterate_mainloop(struct wav_mainloop *loop) {
+	pa_mainloop_api *api = &loop->api;
+
+	// newly created events are inserted at the head of the list, so they are not dispatched until the next round
+	pa_defer_event *defer_event;
+	wl_list_for_each(defer_event, &loop->defer_events, link) {
+		if (defer_event->enabled) defer_event->callback(api, defer_event, defer_event->userdata);
+	}
+
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	int count = epoll_wait(loop->epollfd, events, MAX_EPOLL_EVENTS, get_timeout(loop));
+	if (count < 0) {
+		if (errno != EINTR) return -1;
+		count = 0;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		pa_io_event *io_event = events[i].data.ptr;
+		if (io_event->dead) continue;
+		io_event->callback(api, io_event, io_event->fd, from_epoll_events(events[i].events), io_event->userdata);
+	}
+
+	int64_t now = get_time(CLOCK_MONOTONIC);
+	pa_time_event *time_event;
+	wl_list_for_each(time_event, &loop->time_events, link) {
+		if (!time_event->enabled || time_event->deadline > now) continue;
+		time_event->enabled = false;
+		time_event->callback(api, time_event, &time_event->time, time_event->userdata);
+	}
+
+	if (loop->has_dead_events) collect_dead_events(loop, false);
+
+	return count;
+}
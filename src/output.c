@@ -1,16 +1,26 @@
 #define _XOPEN_SOURCE 500
 
+#include "audio.h"
 #include "buffer.h"
 #include "config.h"
 #include "output.h"
 #include "render.h"
+#include "waterfall.h"
 #include "wav.h"
 
 #include "xdg-output-unstable-v1-client-protocol.h"
 
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// compositors stop answering frame callbacks for surfaces that are obscured or on outputs that are off,
+// this is long enough that even the lowest variable refresh rates do not trip it
+#define FRAME_TIMEOUT 500000000 // ns
 
 static void noop() {
 	// intentionally left blank
@@ -25,19 +35,75 @@ static void handle_xdg_output_name(void *data, struct zxdg_output_v1 *xdg_output
 	// if (!string_list_contains(outputs, name)) destroy_output(output);
 }
 
+static void update_output_buffers(struct wav_output *output) {
+	struct wav_state *state = output->state;
+	if (output->surface_width == 0 || output->surface_height == 0) return; // not yet configured
+	if (!state->pixel_format_settled) return; // see create_output_buffers()
+
+	float factor = output->scale;
+	if (output->viewport != NULL) {
+		if (output->preferred_scale != 0) factor = output->preferred_scale/120.0f;
+		factor /= state->config.render_scale*(output->quality >= WAV_QUALITY_HALF_RESOLUTION ? 2 : 1);
+		wp_viewport_set_destination(output->viewport, output->surface_width, output->surface_height);
+	} else {
+		wl_surface_set_buffer_scale(output->surface, output->scale);
+	}
+
+	output->width = ceilf(output->surface_width*factor);
+	output->height = ceilf(output->surface_height*factor);
+
+	// the colour tables are built in the pixel format
+	output->pixel_format = state->pixel_format;
+	destroy_bars(output);
+	bool created = create_bars(output);
+	resize_audio(state);
+
+	// the buffer last committed is still shown until one at the new size replaces it
+	if (output->busy_buffer != NULL) retire_buffer(output->busy_buffer);
+	if (output->free_buffer != NULL) retire_buffer(output->free_buffer);
+	if (output->waterfall != NULL) destroy_waterfall(output->waterfall);
+	output->busy_buffer = output->free_buffer = NULL;
+	output->waterfall = NULL;
+	// left blank until the next configure tries again, draw_frame() skips outputs without bars
+	if (!created) return;
+	if (state->config.waterfall) {
+		output->waterfall = create_waterfall(output);
+	} else {
+		output->busy_buffer = create_buffer(output);
+		output->free_buffer = create_buffer(output);
+	}
+}
+
+// the renderer is only woken when the audio starts, so anything it was drawing is drawn again at the new size
+static void reconfigure_output(struct wav_output *output) {
+	update_output_buffers(output);
+	if (output->width > 0 && output->height > 0) render_output(output);
+}
+
+void create_output_buffers(struct wav_state *state) {
+	struct wav_output *output;
+	wl_list_for_each(output, &state->outputs, link) update_output_buffers(output);
+}
+
+void set_output_quality(struct wav_output *output, enum wav_quality quality) {
+	bool rescaled = (quality >= WAV_QUALITY_HALF_RESOLUTION) != (output->quality >= WAV_QUALITY_HALF_RESOLUTION);
+	output->quality = quality;
+	output->quality_frames = 0;
+	output->frame_cost = 0; // says nothing about the new tier
+	++output->quality_changes;
+	if (rescaled) update_output_buffers(output);
+}
+
 static void configure_layer_surface(void *data, struct zwlr_layer_surface_v1 *layer_surface,
 		uint32_t serial, uint32_t width, uint32_t height) {
 	struct wav_output *output = data;
 
-	output->height = height;
-	output->width = width;
+	output->surface_height = height;
+	output->surface_width = width;
 
 	zwlr_layer_surface_v1_ack_configure(layer_surface, serial);
 
-	create_bars(output);
-
-	output->busy_buffer = create_buffer(output);
-	output->free_buffer = create_buffer(output);
+	reconfigure_output(output);
 }
 
 static void close_layer_surface(void *data, struct zwlr_layer_surface_v1 *layer_surface) {
@@ -47,11 +113,34 @@ static void close_layer_surface(void *data, struct zwlr_layer_surface_v1 *layer_
 
 static void scale_output(void *data, struct wl_output *wl_output, int32_t factor) {
 	struct wav_output *output = data;
+	if (output->scale == factor) return;
+
 	output->scale = factor;
+	if (output->preferred_scale == 0) reconfigure_output(output);
+}
+
+static void set_preferred_scale(void *data, struct wp_fractional_scale_v1 *fractional_scale, uint32_t scale) {
+	struct wav_output *output = data;
+	if (output->preferred_scale == scale) return;
+
+	output->preferred_scale = scale;
+	reconfigure_output(output);
+}
+
+static void enter_surface(void *data, struct wl_surface *surface, struct wl_output *wl_output) {
+	struct wav_output *output = data;
+	output->on_output = true;
+	update_visibility(output->state);
 }
 
-void create_output(struct wav_state *state, struct wl_output *wl_output) {
-	struct wav_output *output = malloc(sizeof(*output));
+static void leave_surface(void *data, struct wl_surface *surface, struct wl_output *wl_output) {
+	struct wav_output *output = data;
+	output->on_output = false;
+	update_visibility(output->state);
+}
+
+void create_output(struct wav_state *state, struct wl_output *wl_output, uint32_t name) {
+	struct wav_output *output = calloc(1, sizeof(*output));
 	if (output == NULL) {
 		fputs("Failed to allocate memory for output object\n", stderr);
 		return;
@@ -59,7 +148,16 @@ void create_output(struct wav_state *state, struct wl_output *wl_output) {
 
 	output->state = state;
 	output->wl_output = wl_output;
+	output->name = name;
 	output->scale = 1;
+	output->amplitude_scale = 0.125;
+	output->on_output = true; // until told otherwise, as enter may only come once the surface is mapped
+	wl_list_init(&output->retired_buffers);
+
+	// outputs take the sources in turn, in the order they appear
+	output->source = state->next_source;
+	int source_count = state->config.source_count > 0 ? state->config.source_count : 1;
+	state->next_source = (state->next_source + 1) % source_count;
 
 	static struct wl_output_listener output_listener = {
 		.done = noop,
@@ -82,6 +180,11 @@ void create_output(struct wav_state *state, struct wl_output *wl_output) {
 	}
 
 	output->surface = wl_compositor_create_surface(state->compositor);
+	static const struct wl_surface_listener surface_listener = {
+		.enter = enter_surface,
+		.leave = leave_surface
+	};
+	wl_surface_add_listener(output->surface, &surface_listener, output);
 	output->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
 			state->layer_shell,
 			output->surface,
@@ -95,6 +198,19 @@ void create_output(struct wav_state *state, struct wl_output *wl_output) {
 	};
 	zwlr_layer_surface_v1_add_listener(output->layer_surface, &layer_surface_listener, output);
 
+	// without a viewport, only integer scales can be honoured and the render scale is ignored
+	if (state->viewporter != NULL) {
+		output->viewport = wp_viewporter_get_viewport(state->viewporter, output->surface);
+		if (state->fractional_scale_manager != NULL) {
+			output->fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(
+					state->fractional_scale_manager, output->surface);
+			static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+				.preferred_scale = set_preferred_scale
+			};
+			wp_fractional_scale_v1_add_listener(output->fractional_scale, &fractional_scale_listener, output);
+		}
+	}
+
 	zwlr_layer_surface_v1_set_anchor(output->layer_surface,
 			ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT | ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP);
 
@@ -104,16 +220,83 @@ void create_output(struct wav_state *state, struct wl_output *wl_output) {
 }
 
 void destroy_output(struct wav_output *output) {
+	struct wav_state *state = output->state;
 	wl_list_remove(&output->link);
 
-	destroy_buffer(output->busy_buffer);
-	destroy_buffer(output->free_buffer);
+	if (output->frame_callback != NULL) wl_callback_destroy(output->frame_callback);
 
+	if (output->busy_buffer != NULL) destroy_buffer(output->busy_buffer);
+	if (output->free_buffer != NULL) destroy_buffer(output->free_buffer);
+	struct wav_buffer *buffer, *tmp;
+	wl_list_for_each_safe(buffer, tmp, &output->retired_buffers, link) {
+		wl_list_remove(&buffer->link);
+		destroy_buffer(buffer);
+	}
+	if (output->waterfall != NULL) destroy_waterfall(output->waterfall);
+
+	if (output->fractional_scale != NULL) wp_fractional_scale_v1_destroy(output->fractional_scale);
+	if (output->viewport != NULL) wp_viewport_destroy(output->viewport);
 	zwlr_layer_surface_v1_destroy(output->layer_surface);
 	wl_surface_destroy(output->surface);
 	wl_output_destroy(output->wl_output);
 
-	free(output->bars);
+	destroy_bars(output);
 	free(output);
+
+	resize_audio(state);
+	update_visibility(state);
+}
+
+void update_visibility(struct wav_state *state) {
+	// text is always visible, and other programs may be reading the spectrum or trace
+	if (state->display == NULL || state->config.export_name != NULL || state->config.record_name != NULL) return;
+
+	bool visible = false;
+	struct wav_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (output->on_output && !output->starved) visible = true;
+	}
+	pause_audio(state, !visible);
+}
+
+static void arm_visibility_timer(struct wav_state *state, int64_t deadline) {
+	struct itimerspec spec = {
+		.it_value = {
+			.tv_sec = deadline/1000000000,
+			.tv_nsec = deadline%1000000000
+		}
+	};
+	timerfd_settime(state->visibilityfd, TFD_TIMER_ABSTIME, &spec, NULL);
+	state->visibility_armed = true;
+}
+
+void watch_frame_callback(struct wav_output *output) {
+	// the timer is only moved when it expires, rather than on every frame
+	output->frame_time = get_dsp_time();
+	if (!output->state->visibility_armed) arm_visibility_timer(output->state, output->frame_time + FRAME_TIMEOUT);
+}
+
+void check_visibility(struct wav_state *state) {
+	uint64_t expirations;
+	if (read(state->visibilityfd, &expirations, sizeof(expirations)) < 0) return;
+	state->visibility_armed = false;
+
+	int64_t now = get_dsp_time(), next_deadline = INT64_MAX;
+	bool starved = false;
+	struct wav_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (output->frame_callback == NULL || output->starved) continue;
+
+		int64_t deadline = output->frame_time + FRAME_TIMEOUT;
+		if (deadline <= now) {
+			output->starved = true;
+			starved = true;
+		} else if (deadline < next_deadline) {
+			next_deadline = deadline;
+		}
+	}
+
+	if (next_deadline != INT64_MAX) arm_visibility_timer(state, next_deadline);
+	if (starved) update_visibility(state);
 }
 
@@ -1,39 +1,130 @@
 #include "audio.h"
 #include "buffer.h"
+#include "color.h"
+#include "dsp.h"
 // #include "config.h"
+#include "probes.h"
 #include "render.h"
+#include "text.h"
+#include "trace.h"
+#include "waterfall.h"
+#include "waveform.h"
 #include "output.h"
 
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 
 #include <math.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <wayland-client.h>
 
+static enum wav_bucket_kind get_bucket_kind(enum bar_type type) {
+	if (type & (BOTTOM | TOP)) return STRAIGHT_HORIZONTAL_BARS;
+	if (type & (LEFT | RIGHT)) return STRAIGHT_VERTICAL_BARS;
+	if (type & (SKEWED_BOTTOM | SKEWED_TOP)) return SKEWED_HORIZONTAL_BARS;
+	if (type & (SKEWED_LEFT | SKEWED_RIGHT)) return SKEWED_VERTICAL_BARS;
+	return CORNER_BARS;
+}
+
+// line of pixels nearest to the edge that a bar grows from
+static int get_bar_origin(struct wav_output *output, enum bar_type type) {
+	switch (type) {
+		case BOTTOM:
+		case SKEWED_BOTTOM: return output->height - 1;
+		case RIGHT:
+		case SKEWED_RIGHT: return output->width - 1;
+		case CORNER_BOTTOM_LEFT:
+		case CORNER_BOTTOM_RIGHT: return output->height; // rows are offset by one, the first is clipped
+		default: return 0;
+	}
+}
+
+static bool create_buckets(struct wav_output *output) {
+	output->buckets = calloc(BUCKET_KIND_COUNT, sizeof(*output->buckets));
+	if (output->buckets == NULL) return false;
+
+	int counts[BUCKET_KIND_COUNT] = {0};
+	for (int i = 0; i < output->spectrum_size; ++i) ++counts[get_bucket_kind(output->bars[i].type)];
+
+	for (int kind = 0; kind < BUCKET_KIND_COUNT; ++kind) {
+		struct wav_bar_bucket *bucket = &output->buckets[kind];
+		int count = counts[kind];
+
+		// a single allocation split into one array per field, all of which are four bytes wide
+		void *block = malloc(count*(3*sizeof(int) + 4*sizeof(float)) + 1);
+		if (block == NULL) return false;
+		bucket->count = 0;
+		bucket->index = block;
+		bucket->origin = bucket->index + count;
+		bucket->step = bucket->origin + count;
+		bucket->start = (float *) (bucket->step + count);
+		bucket->end = bucket->start + count;
+		bucket->top_start = bucket->end + count;
+		bucket->top_end = bucket->top_start + count;
+	}
+
+	for (int i = 0; i < output->spectrum_size; ++i) {
+		struct wav_bar *bar = &output->bars[i];
+		struct wav_bar_bucket *bucket = &output->buckets[get_bucket_kind(bar->type)];
+		int j = bucket->count++;
+		bucket->index[j] = i;
+		bucket->start[j] = bar->start;
+		bucket->end[j] = bar->end;
+		bucket->top_start[j] = bar->top_start;
+		bucket->top_end[j] = bar->top_end;
+		bucket->origin[j] = get_bar_origin(output, bar->type);
+		bucket->step[j] = bar->type & (BOTTOM | RIGHT | SKEWED_BOTTOM | SKEWED_RIGHT |
+				CORNER_BOTTOM_LEFT | CORNER_BOTTOM_RIGHT) ? -1 : 1;
+	}
+
+	output->bar_heights = calloc(output->spectrum_size, sizeof(*output->bar_heights));
+	return output->bar_heights != NULL;
+}
+
+void destroy_bars(struct wav_output *output) {
+	if (output->buckets != NULL) {
+		for (int kind = 0; kind < BUCKET_KIND_COUNT; ++kind) free(output->buckets[kind].index);
+	}
+	free(output->buckets);
+	free(output->bar_heights);
+	destroy_colors(output);
+	free(output->bars);
+	output->buckets = NULL;
+	output->bar_heights = NULL;
+	output->bars = NULL;
+}
+
 // TODO: what if output dimensions are odd
 bool create_bars(struct wav_output *output) {
+	// the layout is built in surface-local coordinates, so that the number of bars does not depend on the scale
 	struct wav_config config = output->state->config;
+	int height = output->surface_height;
+	int width = output->surface_width;
 	int total_bar_width = config.bar_width + 2*config.bar_margin;
-	int bar_count = (output->height + output->width)/total_bar_width;
+	int bar_count = (height + width)/total_bar_width;
 	output->spectrum_size = bar_count;
 
 	output->bars = calloc(output->spectrum_size, sizeof(*output->bars));
 	if (output->bars == NULL) {
+		fputs("Failed to allocate memory for bars\n", stderr);
+		output->spectrum_size = 0;
 		return false;
 	}
 
 	int bar_height = config.bar_height;
 	int roundness = config.roundness*bar_height;
 
-	int horizontal_bar_count = (output->height - 2*roundness)/total_bar_width;
+	int horizontal_bar_count = (height - 2*roundness)/total_bar_width;
 	if (horizontal_bar_count % 2 != bar_count % 2) ++horizontal_bar_count;
 
-	int vertical_bar_count = (output->width/2 - roundness)/total_bar_width;
+	int vertical_bar_count = (width/2 - roundness)/total_bar_width;
 	int corner_bar_count = (bar_count - horizontal_bar_count)/2 - vertical_bar_count;
 
-	int x = output->width/2 - config.bar_margin;
+	int x = width/2 - config.bar_margin;
 	for (int i = 0; i < vertical_bar_count; ++i) {
 		struct wav_bar *bar = &output->bars[i];
 		bar->type = BOTTOM;
@@ -47,7 +138,7 @@ bool create_bars(struct wav_output *output) {
 		x -= total_bar_width;
 	}
 
-	int y = (output->height - total_bar_width*horizontal_bar_count)/2 - config.bar_margin;
+	int y = (height - total_bar_width*horizontal_bar_count)/2 - config.bar_margin;
 
 	// x + y = corner_bar_count*corner_bar_width + (corner_bar_count - 1)*2*corner_bar_margin
 	//  where: corner_bar_width/corner_bar_margin = bar_width/bar_margin
@@ -55,13 +146,13 @@ bool create_bars(struct wav_output *output) {
 	float corner_bar_margin = (x + y - corner_bar_count*corner_bar_width)/(corner_bar_count - 1)/2;
 	float corner_bar_total_width = corner_bar_width + 2*corner_bar_margin;
 
-	y = output->height - y;
+	y = height - y;
 
 	float corner_x = x;
-	float corner_y = output->height;
+	float corner_y = height;
 	enum bar_type current_type = SKEWED_BOTTOM;
 	int center_x = roundness;
-	int center_y = output->height - roundness;
+	int center_y = height - roundness;
 	for (int i = vertical_bar_count; i < vertical_bar_count + corner_bar_count; ++i) {
 		struct wav_bar *bar = &output->bars[i];
 		bar->type = current_type;
@@ -105,13 +196,13 @@ bool create_bars(struct wav_output *output) {
 		} else {
 			if (bar->type == CORNER_BOTTOM_LEFT) {
 				mirror_bar->type = CORNER_TOP_LEFT;
-				mirror_bar->start = output->height - bar->start;
-				mirror_bar->top_start = output->height - bar->top_start;
+				mirror_bar->start = height - bar->start;
+				mirror_bar->top_start = height - bar->top_start;
 			} else {
-				mirror_bar->start = output->height - bar->end;
-				mirror_bar->end = output->height - bar->start;
-				mirror_bar->top_start = output->height - bar->top_end;
-				mirror_bar->top_end = output->height - bar->top_start;
+				mirror_bar->start = height - bar->end;
+				mirror_bar->end = height - bar->start;
+				mirror_bar->top_start = height - bar->top_end;
+				mirror_bar->top_end = height - bar->top_start;
 			}
 		}
 	}
@@ -138,6 +229,24 @@ bool create_bars(struct wav_output *output) {
 		y -= total_bar_width;
 	}
 
+	float factor = (float) output->width/width;
+	for (int i = 0; i < bar_count; ++i) {
+		struct wav_bar *bar = &output->bars[i];
+		bar->start *= factor;
+		bar->end *= factor;
+		bar->top_start *= factor;
+		bar->top_end *= factor;
+	}
+	output->bar_height = roundf(bar_height*factor);
+
+	// whatever was allocated before the failure is freed, so that the output is left without bars at all
+	if (!create_buckets(output) || !create_colors(output)) {
+		fputs("Failed to allocate memory for bars\n", stderr);
+		destroy_bars(output);
+		output->spectrum_size = 0;
+		return false;
+	}
+
 	// int i = vertical_bar_count - 1;
 	// printf("%d: %f %f\n", i, output->bars[i].end, output->bars[i].start);
 	// i = vertical_bar_count;
@@ -158,87 +267,255 @@ bool create_bars(struct wav_output *output) {
 	return true;
 }
 
-static void draw_mirrored_pixel(struct wav_output *output, int x, int y, uint32_t color) {
-	uint32_t *canvas = output->free_buffer->data;
-	canvas[output->width*y + x] = color;
-	canvas[output->width*(y + 1) - 1 - x] = color;
+static void fill_pixels(void *data, int bytes_per_pixel, int length, uint32_t color) {
+	unsigned char *pixel = data;
+	unsigned char *end = pixel + (size_t) length*bytes_per_pixel;
+
+	// the colour repeated across a word, so that the bulk of the span is filled a word at a time
+	uint64_t pattern = bytes_per_pixel == 2 ?
+		UINT64_C(0x0001000100010001)*(uint16_t) color : UINT64_C(0x0000000100000001)*color;
+	while (pixel < end && (uintptr_t) pixel % sizeof(pattern) != 0) {
+		memcpy(pixel, &pattern, bytes_per_pixel);
+		pixel += bytes_per_pixel;
+	}
+	for (; end - pixel >= (ptrdiff_t) sizeof(pattern); pixel += sizeof(pattern)) memcpy(pixel, &pattern, sizeof(pattern));
+	for (; pixel < end; pixel += bytes_per_pixel) memcpy(pixel, &pattern, bytes_per_pixel);
 }
 
-static void render_straight_bar(struct wav_output *output, struct wav_bar *bar, int bar_height, uint32_t color) {
-	int x_start, x_end, y_start, y_end;
-	switch (bar->type) {
-		case BOTTOM:
-			x_start = bar->start;
-			x_end = bar->end;
-			y_start = output->height - bar_height;
-			y_end = output->height;
-			break;
-		case LEFT:
-			x_start = 0;
-			x_end = bar_height;
-			y_start = bar->start;
-			y_end = bar->end;
-			break;
-		case RIGHT:
-			x_start = output->width - bar_height;
-			x_end = output->width;
-			y_start = bar->start;
-			y_end = bar->end;
+static void fill_span(struct wav_output *output, int offset, int length, uint32_t color) {
+	int bytes_per_pixel = output->pixel_format->bytes_per_pixel;
+	fill_pixels((unsigned char *) output->free_buffer->data + (size_t) offset*bytes_per_pixel, bytes_per_pixel, length, color);
+}
+
+static void fill_mirrored_row(struct wav_output *output, int x_start, int x_end, int y, uint32_t color) {
+	if (x_end <= x_start) return;
+	fill_span(output, output->width*y + x_start, x_end - x_start, color);
+	fill_span(output, output->width*(y + 1) - x_end, x_end - x_start, color);
+}
+
+static void fill_mirrored_column(struct wav_output *output, int x, int y_start, int y_end, uint32_t color) {
+	void *canvas = output->free_buffer->data;
+	int width = output->width;
+	switch (output->pixel_format->bytes_per_pixel) {
+		case 2:
+			for (uint16_t *pixel = canvas; y_start < y_end; ++y_start) {
+				pixel[width*y_start + x] = color;
+				pixel[width*(y_start + 1) - 1 - x] = color;
+			}
 			break;
-		case TOP:
-			x_start = bar->start;
-			x_end = bar->end;
-			y_start = 0;
-			y_end = bar_height;
+		case 4:
+			for (uint32_t *pixel = canvas; y_start < y_end; ++y_start) {
+				pixel[width*y_start + x] = color;
+				pixel[width*(y_start + 1) - 1 - x] = color;
+			}
 			break;
-		default: // this should never happen
-			return;
 	}
+}
+
+// copies the gradient into the first and last length pixels of row y, growing inwards from both edges
+static void fill_gradient_row(struct wav_output *output, int length, int y) {
+	if (length <= 0) return;
+	int bytes_per_pixel = output->pixel_format->bytes_per_pixel;
+	unsigned char *row = (unsigned char *) output->free_buffer->data + (size_t) output->width*y*bytes_per_pixel;
+	const unsigned char *reversed_span = output->colors.reversed_span;
+	memcpy(row, output->colors.span, length*bytes_per_pixel);
+	memcpy(row + (output->width - length)*bytes_per_pixel,
+			reversed_span + (output->bar_height - length)*bytes_per_pixel, length*bytes_per_pixel);
+}
+
+// the colour of bar i at height h is colors[stride*h]
+static const uint32_t *get_bar_colors(struct wav_output *output, int i, int *stride) {
+	*stride = output->colors.row != NULL;
+	return *stride ? output->colors.row : &output->colors.bar[i];
+}
 
-	for (int y = y_start; y < y_end; ++y) {
-		for (int x = x_start; x < x_end; ++x) draw_mirrored_pixel(output, x, y, color);
+static void render_straight_horizontal_bars(struct wav_output *output, const int *bar_heights) {
+	struct wav_bar_bucket *bucket = &output->buckets[STRAIGHT_HORIZONTAL_BARS];
+	for (int j = 0; j < bucket->count; ++j) {
+		int i = bucket->index[j], stride;
+		const uint32_t *colors = get_bar_colors(output, i, &stride);
+		for (int h = 0; h < bar_heights[i]; ++h) {
+			fill_mirrored_row(output, bucket->start[j], bucket->end[j], bucket->origin[j] + bucket->step[j]*h, colors[stride*h]);
+		}
 	}
 }
 
-static void render_skewed_bar(struct wav_output *output, struct wav_bar *bar, int bar_height, uint32_t color) {
-	int max_bar_height = output->state->config.bar_height;
-	for (int h = 0; h < bar_height; ++h) {
-		int start = roundf(bar->start + (bar->top_start - bar->start)*h/max_bar_height);
-		int end = roundf(bar->end + (bar->top_end - bar->end)*h/max_bar_height);
-
-		if (bar->type == SKEWED_BOTTOM || bar->type == SKEWED_TOP) {
-			int y = bar->type == SKEWED_BOTTOM ? output->height - 1 - h : h;
-			for (int x = start; x < end; ++x) draw_mirrored_pixel(output, x, y, color);
-		} else if (bar->type == SKEWED_LEFT || bar->type == SKEWED_RIGHT) {
-			int x = bar->type == SKEWED_RIGHT ? output->width - 1 - h : h;
-			for (int y = start; y < end; ++y) draw_mirrored_pixel(output, x, y, color);
+static void render_straight_vertical_bars(struct wav_output *output, const int *bar_heights) {
+	struct wav_bar_bucket *bucket = &output->buckets[STRAIGHT_VERTICAL_BARS];
+	for (int j = 0; j < bucket->count; ++j) {
+		int i = bucket->index[j];
+		if (output->colors.span != NULL) {
+			for (int y = bucket->start[j]; y < (int) bucket->end[j]; ++y) fill_gradient_row(output, bar_heights[i], y);
+			continue;
 		}
+
+		uint32_t color = output->colors.bar[i];
+		int x_start = bucket->step[j] > 0 ? bucket->origin[j] : bucket->origin[j] + 1 - bar_heights[i];
+		int x_end = x_start + bar_heights[i];
+		for (int y = bucket->start[j]; y < (int) bucket->end[j]; ++y) fill_mirrored_row(output, x_start, x_end, y, color);
 	}
 }
 
-static void render_corner_bar(struct wav_output *output, struct wav_bar *bar, int bar_height, uint32_t color) {
-	int max_bar_height = output->state->config.bar_height;
-	float bar_top = bar->start + (bar->top_start - bar->start)*bar_height/max_bar_height;
-	float bar_edge = bar->end + (bar->top_end - bar->end)*bar_height/max_bar_height;
-	float shape_height = bar_top;
-	if (bar->type == CORNER_BOTTOM_LEFT) shape_height = output->height - shape_height;
-
-	for (int h = 0; h < roundf(shape_height); ++h) {
-		int y = bar->type == CORNER_BOTTOM_LEFT ? output->height - h :
-			bar->type == CORNER_TOP_LEFT ? h : 0;
-		float x_start = (y - bar->start)/(bar->top_start - bar->start)*max_bar_height;
-		if (x_start < 0) x_start = 0;
-		float x_end = h > max_bar_height ? max_bar_height :
-			h > bar_height ?  bar_edge + (bar_height - bar_edge)*(h - bar_height)/(shape_height - bar_height):
-			bar->end + (bar->top_end - bar->end)*h/max_bar_height;
-		for (int x = roundf(x_start); x < roundf(x_end); ++x) draw_mirrored_pixel(output, x, y, color);
+static void render_skewed_horizontal_bars(struct wav_output *output, const int *bar_heights) {
+	struct wav_bar_bucket *bucket = &output->buckets[SKEWED_HORIZONTAL_BARS];
+	int max_bar_height = output->bar_height;
+	for (int j = 0; j < bucket->count; ++j) {
+		int i = bucket->index[j], stride;
+		const uint32_t *colors = get_bar_colors(output, i, &stride);
+		float start_slope = (bucket->top_start[j] - bucket->start[j])/max_bar_height;
+		float end_slope = (bucket->top_end[j] - bucket->end[j])/max_bar_height;
+		for (int h = 0; h < bar_heights[i]; ++h) {
+			fill_mirrored_row(output, roundf(bucket->start[j] + start_slope*h), roundf(bucket->end[j] + end_slope*h),
+					bucket->origin[j] + bucket->step[j]*h, colors[stride*h]);
+		}
 	}
 }
 
-static void render_bar(struct wav_output *output, struct wav_bar *bar, int bar_height, uint32_t color) {
-	if (bar->type & STRAIGHT_BAR_TYPE) render_straight_bar(output, bar, bar_height, color);
-	else if (bar->type & SKEWED_BAR_TYPE) render_skewed_bar(output, bar, bar_height, color);
-	else if (bar->type & CORNER_BAR_TYPE) render_corner_bar(output, bar, bar_height, color);
+static void render_skewed_vertical_bars(struct wav_output *output, const int *bar_heights) {
+	struct wav_bar_bucket *bucket = &output->buckets[SKEWED_VERTICAL_BARS];
+	int max_bar_height = output->bar_height;
+	for (int j = 0; j < bucket->count; ++j) {
+		int i = bucket->index[j], stride;
+		const uint32_t *colors = get_bar_colors(output, i, &stride);
+		float start_slope = (bucket->top_start[j] - bucket->start[j])/max_bar_height;
+		float end_slope = (bucket->top_end[j] - bucket->end[j])/max_bar_height;
+		for (int h = 0; h < bar_heights[i]; ++h) {
+			fill_mirrored_column(output, bucket->origin[j] + bucket->step[j]*h,
+					roundf(bucket->start[j] + start_slope*h), roundf(bucket->end[j] + end_slope*h), colors[stride*h]);
+		}
+	}
+}
+
+static void render_corner_bars(struct wav_output *output, const int *bar_heights) {
+	struct wav_bar_bucket *bucket = &output->buckets[CORNER_BARS];
+	int max_bar_height = output->bar_height;
+	for (int j = 0; j < bucket->count; ++j) {
+		int i = bucket->index[j];
+		int bar_height = bar_heights[i];
+		if (bar_height == 0) continue;
+
+		int stride;
+		const uint32_t *colors = get_bar_colors(output, i, &stride);
+		float start = bucket->start[j], end = bucket->end[j];
+		float top_start = bucket->top_start[j], top_end = bucket->top_end[j];
+		int origin = bucket->origin[j], step = bucket->step[j];
+
+		float bar_top = start + (top_start - start)*bar_height/max_bar_height;
+		float bar_edge = end + (top_end - end)*bar_height/max_bar_height;
+		float shape_height = origin + step*bar_top;
+
+		for (int h = 0; h < roundf(shape_height); ++h) {
+			int y = origin + step*h;
+			if (y >= output->height) continue;
+			int row = step > 0 ? y : output->height - 1 - y; // from the edge
+			if (row >= max_bar_height) row = max_bar_height - 1;
+
+			float x_start = (y - start)/(top_start - start)*max_bar_height;
+			if (x_start < 0) x_start = 0;
+			float x_end = h > max_bar_height ? max_bar_height :
+				h > bar_height ?  bar_edge + (bar_height - bar_edge)*(h - bar_height)/(shape_height - bar_height):
+				end + (top_end - end)*h/max_bar_height;
+			fill_mirrored_row(output, roundf(x_start), roundf(x_end), y, colors[stride*row]);
+		}
+	}
+}
+
+void render_bucket(struct wav_output *output, enum wav_bucket_kind kind, const int *bar_heights) {
+	switch (kind) {
+		case STRAIGHT_HORIZONTAL_BARS: render_straight_horizontal_bars(output, bar_heights); break;
+		case STRAIGHT_VERTICAL_BARS: render_straight_vertical_bars(output, bar_heights); break;
+		case SKEWED_HORIZONTAL_BARS: render_skewed_horizontal_bars(output, bar_heights); break;
+		case SKEWED_VERTICAL_BARS: render_skewed_vertical_bars(output, bar_heights); break;
+		case CORNER_BARS: render_corner_bars(output, bar_heights); break;
+		default: break;
+	}
+}
+
+void follow_amplitude(float *scale, int64_t *time, float max_amplitude, int64_t now) {
+	// outputs refresh at different rates, so the inertia is per 60 Hz frame rather than per frame drawn
+	static const float inertia_up = 0.75;
+	static const float inertia_down = 1.0/32;
+	float frames = *time == 0 ? 1 : (now - *time)*60e-9;
+	if (frames > 4) frames = 4; // resuming after being idle
+	float inertia = 1 - powf(1 - (max_amplitude > *scale ? inertia_up : inertia_down), frames);
+	*scale = inertia*max_amplitude + (1 - inertia)*(*scale);
+	*time = now;
+}
+
+float get_bar_level(struct wav_state *state, const struct wav_peaks *peaks, int i, int64_t now, float scale) {
+	float noise_threshold = state->config.noise_threshold;
+	float level = sample_peak(peaks, i, now)/scale;
+	return level < noise_threshold ? 0 :
+		level < 1 ? (level - noise_threshold)/(1 - noise_threshold) : 1;
+}
+
+// both return the maximum amplitude, having filled in output->bar_heights
+static float get_spectrum_heights(struct wav_output *output, int64_t now, int *spectrum_size) {
+	struct wav_state *state = output->state;
+	struct wav_peaks *peaks = &state->sources[output->source].peaks;
+	advance_peaks(peaks, now);
+	float max_amplitude = sample_max_peak(peaks, now);
+	follow_amplitude(&output->amplitude_scale, &output->amplitude_time, max_amplitude, now);
+
+	// the analysis only falls short of an output if it could not be resized
+	int *bar_heights = output->bar_heights;
+	if (*spectrum_size > peaks->size) *spectrum_size = peaks->size;
+	memset(bar_heights + *spectrum_size, 0, (output->spectrum_size - *spectrum_size)*sizeof(*bar_heights));
+	for (int i = 0; i < *spectrum_size; ++i) {
+		bar_heights[i] = roundf(get_bar_level(state, peaks, i, now, output->amplitude_scale)*output->bar_height);
+	}
+	return max_amplitude;
+}
+
+// each bar is one node of the pyramid, in time order along the edges, as tall as half its peak-to-peak
+static float get_waveform_heights(struct wav_output *output, int64_t now) {
+	const struct wav_waveform *waveform = &output->state->waveform;
+	int columns = output->spectrum_size;
+	if (waveform->samples == NULL) {
+		// outputs are configured, and drawn, before audio is set up and the pyramid allocated
+		memset(output->bar_heights, 0, columns*sizeof(*output->bar_heights));
+		return 0;
+	}
+	int level = get_waveform_level(waveform, columns);
+	uint64_t end = atomic_load_explicit(&waveform->count, memory_order_acquire) >> level;
+	const float *min = waveform->min[level], *max = waveform->max[level];
+
+	float max_amplitude = 0;
+	for (int i = 0; i < columns; ++i) {
+		size_t node = get_waveform_node(waveform, level, end - columns + i);
+		float amplitude = (max[node] - min[node])/2;
+		if (amplitude > max_amplitude) max_amplitude = amplitude;
+	}
+	follow_amplitude(&output->amplitude_scale, &output->amplitude_time, max_amplitude, now);
+
+	float scale = output->amplitude_scale > 0 ? output->bar_height/output->amplitude_scale : 0;
+	for (int i = 0; i < columns; ++i) {
+		size_t node = get_waveform_node(waveform, level, end - columns + i);
+		float height = (max[node] - min[node])/2*scale;
+		output->bar_heights[i] = roundf(height < output->bar_height ? height : output->bar_height);
+	}
+	return max_amplitude;
+}
+
+void render_waterfall_line(struct wav_output *output, void *line, int64_t now) {
+	struct wav_state *state = output->state;
+	const struct wav_peaks *peaks = &state->sources[output->source].peaks;
+	int bytes_per_pixel = output->pixel_format->bytes_per_pixel;
+	int spectrum_size = output->spectrum_size;
+	if (spectrum_size > peaks->size) spectrum_size = peaks->size;
+	if (spectrum_size <= 0) {
+		memset(line, 0, (size_t) output->width*bytes_per_pixel);
+		return;
+	}
+
+	// the bins are spread evenly across the line, lowest on the left
+	for (int i = 0, x = 0; i < spectrum_size; ++i) {
+		int end = (int) ((int64_t) (i + 1)*output->width/spectrum_size);
+		float level = get_bar_level(state, peaks, i, now, output->amplitude_scale);
+		uint32_t color = output->colors.level[(int) lroundf(level*(WAV_COLOR_LEVELS - 1))];
+		fill_pixels((unsigned char *) line + (size_t) x*bytes_per_pixel, bytes_per_pixel, end - x, color);
+		x = end;
+	}
 }
 
 static void draw_frame(struct wav_output *output);
@@ -246,78 +523,140 @@ static void draw_frame(struct wav_output *output);
 static void handle_frame_done(void *data, struct wl_callback *callback, uint32_t time) {
 	wl_callback_destroy(callback);
 	struct wav_output *output = data;
+	output->frame_callback = NULL;
+	WAV_PROBE2(frame_done, output->name, time);
+	if (output->starved) {
+		output->starved = false;
+		update_visibility(output->state);
+	}
 	draw_frame(output);
 }
 
+static void request_frame(struct wav_output *output) {
+	output->frame_callback = wl_surface_frame(output->surface);
+	static const struct wl_callback_listener frame_listener = {
+		.done = handle_frame_done
+	};
+	wl_callback_add_listener(output->frame_callback, &frame_listener, output);
+	watch_frame_callback(output);
+}
+
+// a single new line for each new spectrum, the rest having been drawn for earlier ones
+static void draw_waterfall(struct wav_output *output) {
+	struct wav_state *state = output->state;
+	struct wav_source *source = &state->sources[output->source];
+	struct wav_waterfall *waterfall = output->waterfall;
+	int64_t now = get_dsp_time();
+	advance_peaks(&source->peaks, now);
+	float max_amplitude = sample_max_peak(&source->peaks, now);
+	follow_amplitude(&output->amplitude_scale, &output->amplitude_time, max_amplitude, now);
+
+	// frames come faster than spectra on high refresh rates, and the waterfall should scroll with the audio
+	unsigned sequence = atomic_load_explicit(&source->peaks.sequence, memory_order_acquire);
+	bool scrolled = !(sequence & 1) && sequence != waterfall->sequence; // odd while a spectrum is being stored
+	if (scrolled) {
+		waterfall->sequence = sequence;
+		render_waterfall_line(output, scroll_waterfall(waterfall), now);
+	}
+
+	struct wl_buffer *wl_buffer = NULL;
+	if (scrolled || waterfall->shown == NULL) {
+		wl_buffer = get_waterfall_view(waterfall, output);
+		wl_surface_attach(output->surface, wl_buffer, 0, 0);
+		// every line has moved within the buffer
+		wl_surface_damage_buffer(output->surface, 0, 0, output->width, output->height);
+		waterfall->shown = wl_buffer;
+	}
+
+	if ((!atomic_load_explicit(&source->silent, memory_order_relaxed) || max_amplitude > 0) && atomic_load_explicit(&state->running, memory_order_relaxed)) {
+		request_frame(output);
+	}
+
+	wl_surface_commit(output->surface);
+	WAV_PROBE4(draw_end, output->name, output->spectrum_size, false, wl_buffer);
+}
+
+// a tier is only judged once it has settled, and a better one only tried again after a while with headroom
+#define QUALITY_SETTLE_FRAMES 30
+#define QUALITY_HOLD_FRAMES 240
+
+// steps down a tier while drawing takes longer than the budget, and back up while it takes less than half
+static void adapt_quality(struct wav_output *output, int64_t cost) {
+	output->frame_cost = output->frame_cost == 0 ? cost : output->frame_cost + (cost - output->frame_cost)/8;
+	++output->quality_frames;
+	int64_t budget = (int64_t) output->state->config.frame_budget*1000;
+	if (budget <= 0 || output->quality_frames < QUALITY_SETTLE_FRAMES) return;
+
+	enum wav_quality lowest = output->viewport != NULL ? WAV_QUALITY_HALF_RESOLUTION : WAV_QUALITY_NO_CORNERS;
+	if (output->frame_cost > budget && output->quality < lowest) {
+		set_output_quality(output, output->quality + 1);
+	} else if (output->frame_cost < budget/2 && output->quality > WAV_QUALITY_FULL &&
+			output->quality_frames >= QUALITY_HOLD_FRAMES) {
+		set_output_quality(output, output->quality - 1);
+	}
+}
+
 static void draw_frame(struct wav_output *output) {
+	if (output->bars == NULL) return; // never laid out, or could not be
+	WAV_PROBE1(draw_start, output->name);
+	if (output->state->config.waterfall) {
+		if (output->waterfall != NULL) draw_waterfall(output);
+		return;
+	}
 	if (output->free_buffer == NULL) {
 		output->free_buffer = create_buffer(output);
 		if (output->free_buffer == NULL) return;
 	}
-	if (output->free_buffer->busy) return;
+	if (output->free_buffer->busy) {
+		output->free_buffer->pending = true;
+		WAV_PROBE4(draw_end, output->name, 0, true, output->free_buffer);
+		return;
+	}
 
 	struct wav_state *state = output->state;
-	uint32_t *canvas = output->free_buffer->data;
+	int64_t start = get_dsp_time();
 	int size = output->height * output->width;
-	memset(canvas, 0, size*sizeof(*canvas));
-
-	int max_bar_height = state->config.bar_height;
-	diminish_bars(state);
-	static float scale = 0.125;
-	static const float inertia_up = 0.75;
-	static const float inertia_down = 1.0/32;
-	float inertia = state->max_amplitude > scale ? inertia_up : inertia_down;
-	scale = inertia*state->max_amplitude + (1 - inertia)*scale;
-
-	struct wav_bar *bars = output->bars;
-	for (int i = 0; i < output->spectrum_size; ++i) {
-		float bar_height = state->frequency_spectrum[i]/scale;
-		if (bar_height < state->config.noise_threshold) continue;
-		bar_height = bar_height < 1 ?
-			(bar_height - state->config.noise_threshold)/(1 - state->config.noise_threshold) : 1;
-
-		bar_height = roundf(bar_height*max_bar_height);
-		uint32_t color = 0xc0000000 | (((uint32_t) i * 265443761) % (1<<24)); // TODO: change to actual color
-		render_bar(output, &bars[i], bar_height, color);
+	memset(output->free_buffer->data, 0, size*output->pixel_format->bytes_per_pixel);
+
+	int max_bar_height = output->bar_height;
+	int64_t now = get_dsp_time();
+	int spectrum_size = output->spectrum_size;
+	float max_amplitude = state->config.waveform ? get_waveform_heights(output, now) :
+		get_spectrum_heights(output, now, &spectrum_size);
+	for (int kind = 0; kind < BUCKET_KIND_COUNT; ++kind) {
+		if (kind == CORNER_BARS && output->quality >= WAV_QUALITY_NO_CORNERS) continue;
+		render_bucket(output, kind, output->bar_heights);
 	}
 
 	wl_surface_attach(output->surface, output->free_buffer->wl_buffer, 0, 0);
+	output->free_buffer->busy = true; // until the compositor releases it
 	wl_surface_damage_buffer(output->surface, 0, 0, output->width, max_bar_height);
 	wl_surface_damage_buffer(output->surface, 0, 0, max_bar_height, output->height);
 	wl_surface_damage_buffer(output->surface, 0, output->height - max_bar_height, output->width, max_bar_height);
 	wl_surface_damage_buffer(output->surface, output->width - max_bar_height, 0, max_bar_height, output->height);
 
-	bool bars_visible = !state->silent;
-	if (!bars_visible) {
-		for (int i = 0; i < state->spectrum_size; ++i) {
-			if (state->frequency_spectrum[i] > 0) {
-				bars_visible = true;
-				break;
-			}
-		}
-	}
+	bool bars_visible = !atomic_load_explicit(&state->sources[output->source].silent, memory_order_relaxed) ||
+		max_amplitude > 0;
 
-	if (bars_visible && state->running) {
-		state->frame_scheduled = true;
-		struct wl_callback *frame_callback = wl_surface_frame(output->surface);
-		static const struct wl_callback_listener frame_listener = {
-			.done = handle_frame_done
-		};
-		wl_callback_add_listener(frame_callback, &frame_listener, output);
-	} else {
-		state->frame_scheduled = false;
-	}
+	if (bars_visible && atomic_load_explicit(&state->running, memory_order_relaxed)) request_frame(output);
 
 	wl_surface_commit(output->surface);
+	WAV_PROBE4(draw_end, output->name, spectrum_size, false, output->free_buffer);
+	count_replay_frame(state);
 
 	struct wav_buffer *tmp = output->free_buffer;
 	output->free_buffer = output->busy_buffer;
 	output->busy_buffer = tmp;
+
+	adapt_quality(output, get_dsp_time() - start);
+}
+
+void render_output(struct wav_output *output) {
+	if (output->frame_callback == NULL) draw_frame(output);
 }
 
 void render_frame(struct wav_state *state) {
 	struct wav_output *output;
-	wl_list_for_each(output, &state->outputs, link) {
-		draw_frame(output);
-	}
+	wl_list_for_each(output, &state->outputs, link) render_output(output);
+	if (state->text != NULL) render_text(state);
 }
@@ -0,0 +1,92 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "spectrum-export.h"
+#include "spectrum-shm.h"
+#include "wav.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+bool init_spectrum_export(struct wav_state *state) {
+	const char *name = state->config.export_name;
+	if (name == NULL) return true;
+
+	// a segment left behind by an earlier run already has a valid magic, so it is replaced rather than
+	// rewritten under readers that may still have it open
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to create spectrum segment '%s'\n", name);
+		return false;
+	}
+
+	// room for every bin the transform has, as the spectrum grows when larger outputs are added
+	int capacity = get_dsp_capacity(&state->dsp);
+	size_t size = sizeof(struct wav_spectrum_header) + capacity*sizeof(float);
+	if (ftruncate(fd, size) == -1) {
+		fputs("Failed to resize spectrum segment\n", stderr);
+		close(fd);
+		shm_unlink(name);
+		return false;
+	}
+
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fputs("Failed to map spectrum segment to memory\n", stderr);
+		shm_unlink(name);
+		return false;
+	}
+
+	struct wav_spectrum_header *header = data;
+	header->version = WAV_SPECTRUM_VERSION;
+	header->capacity = capacity;
+	atomic_store_explicit(&header->sequence, 0, memory_order_relaxed);
+	header->bins = state->spectrum_size;
+	header->rate = state->dsp.rate;
+	header->frequency_step = state->config.frequency_step;
+	header->flags = WAV_SPECTRUM_SILENT;
+
+	// readers check the magic, so it is only written once everything else is in place
+	atomic_store_explicit(&header->magic, WAV_SPECTRUM_MAGIC, memory_order_release);
+
+	// and the capture side only starts writing once the header is complete
+	state->export_size = size;
+	atomic_store_explicit(&state->export, header, memory_order_release);
+
+	return true;
+}
+
+void finish_spectrum_export(struct wav_state *state) {
+	struct wav_spectrum_header *header = atomic_exchange(&state->export, NULL);
+	if (header == NULL) return;
+
+	munmap(header, state->export_size);
+	shm_unlink(state->config.export_name);
+}
+
+float *begin_spectrum_export(struct wav_state *state) {
+	struct wav_spectrum_header *header = atomic_load_explicit(&state->export, memory_order_acquire);
+	unsigned sequence = atomic_load_explicit(&header->sequence, memory_order_relaxed);
+	atomic_store_explicit(&header->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	return header->spectrum;
+}
+
+void end_spectrum_export(struct wav_state *state, uint32_t flags) {
+	struct wav_spectrum_header *header = atomic_load_explicit(&state->export, memory_order_relaxed);
+
+	struct timespec timestamp;
+	clock_gettime(CLOCK_MONOTONIC, &timestamp);
+	header->timestamp = 1000000000*(int64_t) timestamp.tv_sec + timestamp.tv_nsec;
+	header->bins = state->spectrum_size;
+	header->flags = flags;
+
+	unsigned sequence = atomic_load_explicit(&header->sequence, memory_order_relaxed);
+	atomic_store_explicit(&header->sequence, sequence + 1, memory_order_release);
+}
@@ -0,0 +1,94 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "spectrum-shm.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// a writer that stays mid-update for this many attempts has most likely died there. the first few spin,
+// as an update only takes as long as copying the spectrum, and after that each waits twice as long up to 1ms
+static const int max_attempts = 64;
+static const int spin_attempts = 8;
+
+bool wav_spectrum_reader_open(struct wav_spectrum_reader *reader, const char *name) {
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to open spectrum segment '%s'\n", name);
+		return false;
+	}
+
+	struct stat stat;
+	if (fstat(fd, &stat) == -1 || (size_t) stat.st_size < sizeof(*reader->header)) {
+		fputs("Spectrum segment is too small\n", stderr);
+		close(fd);
+		return false;
+	}
+
+	reader->size = stat.st_size;
+	void *data = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fputs("Failed to map spectrum segment to memory\n", stderr);
+		return false;
+	}
+
+	reader->header = data;
+	if (atomic_load_explicit(&reader->header->magic, memory_order_acquire) != WAV_SPECTRUM_MAGIC || reader->header->version != WAV_SPECTRUM_VERSION ||
+			sizeof(*reader->header) + reader->header->capacity*sizeof(float) > reader->size) {
+		fputs("Spectrum segment has an unknown layout\n", stderr);
+		wav_spectrum_reader_close(reader);
+		return false;
+	}
+
+	return true;
+}
+
+void wav_spectrum_reader_close(struct wav_spectrum_reader *reader) {
+	munmap((void *) reader->header, reader->size);
+	reader->header = NULL;
+}
+
+uint32_t wav_spectrum_reader_sequence(const struct wav_spectrum_reader *reader) {
+	return atomic_load_explicit(&reader->header->sequence, memory_order_acquire);
+}
+
+int wav_spectrum_reader_read(const struct wav_spectrum_reader *reader,
+		float *spectrum, int size, struct wav_spectrum_info *info) {
+	const struct wav_spectrum_header *header = reader->header;
+	for (int attempt = 0; attempt < max_attempts; ++attempt) {
+		if (attempt >= spin_attempts) {
+			int doublings = attempt - spin_attempts < 10 ? attempt - spin_attempts : 10;
+			struct timespec backoff = { .tv_nsec = 1000L << doublings };
+			nanosleep(&backoff, NULL);
+		}
+
+		uint32_t sequence = atomic_load_explicit(&header->sequence, memory_order_acquire);
+		if (sequence & 1) continue; // writer is in the middle of an update
+
+		struct wav_spectrum_info snapshot = {
+			.sequence = sequence,
+			.bins = header->bins,
+			.rate = header->rate,
+			.frequency_step = header->frequency_step,
+			.flags = header->flags,
+			.timestamp = header->timestamp
+		};
+		int bins = (int) snapshot.bins < size ? (int) snapshot.bins : size;
+		if (bins > (int) header->capacity) bins = header->capacity;
+		memcpy(spectrum, header->spectrum, bins*sizeof(*spectrum));
+
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&header->sequence, memory_order_relaxed) != sequence) continue;
+
+		if (info != NULL) *info = snapshot;
+		return bins;
+	}
+	return -1;
+}
@@ -0,0 +1,156 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "dsp.h"
+#include "render.h"
+#include "text.h"
+#include "trace.h"
+#include "wav.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEXT_REFRESH_RATE 30
+
+// from empty to full in eighths
+static const char *blocks[] = { " ", "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█" };
+static const size_t max_block_size = 3;
+
+static const char *swaybar_header = "{\"version\": 1}\n[\n";
+static const char *swaybar_prefix = "[{\"name\": \"wav\", \"full_text\": \"";
+static const char *swaybar_suffix = "\"}],\n";
+
+bool init_text(struct wav_state *state) {
+	wl_list_init(&state->outputs);
+
+	struct wav_text *text = calloc(1, sizeof(*text));
+	if (text == NULL) {
+		fputs("Failed to allocate memory for text output\n", stderr);
+		return false;
+	}
+
+	text->format = state->config.swaybar ? WAV_TEXT_SWAYBAR : WAV_TEXT_TERMINAL;
+	text->columns = state->config.text_columns;
+	text->amplitude_scale = 0.125;
+
+	// the worst case is every cell changing on its own, each needing a cursor movement
+	text->line_size = strlen(swaybar_prefix) + strlen(swaybar_suffix) +
+		text->columns*(max_block_size + sizeof("\x1b[2147483647G"));
+	text->line = malloc(text->line_size);
+	text->levels = malloc(text->columns*sizeof(*text->levels));
+	text->new_levels = malloc(text->columns*sizeof(*text->new_levels));
+	text->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (text->levels != NULL) {
+		for (int i = 0; i < text->columns; ++i) text->levels[i] = -1;
+	}
+	if (text->line == NULL || text->levels == NULL || text->new_levels == NULL || text->timerfd == -1) {
+		fputs("Failed to initialise text output\n", stderr);
+		state->text = text;
+		finish_text(state);
+		return false;
+	}
+
+	if (text->format == WAV_TEXT_SWAYBAR) {
+		fputs(swaybar_header, stdout);
+		fflush(stdout);
+	}
+
+	state->text = text;
+	return true;
+}
+
+void finish_text(struct wav_state *state) {
+	struct wav_text *text = state->text;
+	if (text == NULL) return;
+
+	if (text->format == WAV_TEXT_TERMINAL && text->levels != NULL && text->levels[0] != -1) putchar('\n');
+	if (text->timerfd != -1) close(text->timerfd);
+	free(text->new_levels);
+	free(text->levels);
+	free(text->line);
+	free(text);
+	state->text = NULL;
+}
+
+static char *append(char *cursor, const char *string) {
+	size_t length = strlen(string);
+	memcpy(cursor, string, length);
+	return cursor + length;
+}
+
+// rewrites runs of changed cells in place on the current terminal line
+static size_t format_terminal_line(struct wav_text *text) {
+	char *cursor = text->line;
+	for (int i = 0; i < text->columns; ++i) {
+		if (text->new_levels[i] == text->levels[i]) continue;
+
+		cursor += sprintf(cursor, "\x1b[%dG", i + 1);
+		for (; i < text->columns && text->new_levels[i] != text->levels[i]; ++i) {
+			cursor = append(cursor, blocks[text->new_levels[i]]);
+		}
+	}
+	return cursor - text->line;
+}
+
+static size_t format_swaybar_line(struct wav_text *text) {
+	char *cursor = append(text->line, swaybar_prefix);
+	for (int i = 0; i < text->columns; ++i) cursor = append(cursor, blocks[text->new_levels[i]]);
+	cursor = append(cursor, swaybar_suffix);
+	return cursor - text->line;
+}
+
+static void draw_line(struct wav_state *state) {
+	struct wav_text *text = state->text;
+	struct wav_source *source = &state->sources[0];
+	int64_t now = get_dsp_time();
+	advance_peaks(&source->peaks, now);
+	float max_amplitude = sample_max_peak(&source->peaks, now);
+	follow_amplitude(&text->amplitude_scale, &text->amplitude_time, max_amplitude, now);
+
+	// the analysis only falls short if it could not be resized
+	int spectrum_size = text->columns < source->peaks.size ? text->columns : source->peaks.size;
+	bool changed = false;
+	for (int i = 0; i < text->columns; ++i) {
+		int level = i < spectrum_size ?
+			(int) (get_bar_level(state, &source->peaks, i, now, text->amplitude_scale)*8 + 0.5f) : 0;
+		text->new_levels[i] = level;
+		changed |= level != text->levels[i];
+	}
+
+	if (changed) {
+		size_t size = text->format == WAV_TEXT_SWAYBAR ? format_swaybar_line(text) : format_terminal_line(text);
+		fwrite(text->line, 1, size, stdout);
+		fflush(stdout);
+
+		int *tmp = text->levels;
+		text->levels = text->new_levels;
+		text->new_levels = tmp;
+	}
+	count_replay_frame(state);
+
+	// keep ticking until the bars have fallen after the audio went silent
+	if ((!atomic_load_explicit(&source->silent, memory_order_relaxed) || max_amplitude > 0) && atomic_load_explicit(&state->running, memory_order_relaxed)) {
+		struct itimerspec tick = {
+			.it_value.tv_nsec = 1000000000/TEXT_REFRESH_RATE
+		};
+		timerfd_settime(text->timerfd, 0, &tick, NULL);
+		text->pending = true;
+	}
+}
+
+void render_text(struct wav_state *state) {
+	if (!state->text->pending) draw_line(state);
+}
+
+void handle_text_tick(struct wav_state *state) {
+	uint64_t expirations;
+	read(state->text->timerfd, &expirations, sizeof(expirations));
+	state->text->pending = false;
+	draw_line(state);
+}
@@ -0,0 +1,341 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "dsp.h"
+#include "trace.h"
+#include "wav.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+struct wav_trace {
+	FILE *file;
+	bool quantised;
+	int capacity; // bins
+	uint16_t *magnitudes; // scratch space for quantising
+};
+
+struct wav_replay {
+	struct wav_state *state;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t stop; // signalled to cut a wait for the next frame short, or when a frame is rendered
+	bool stopping;
+	unsigned long rendered; // frames drawn so far, which pace a fast replay
+
+	const unsigned char *data;
+	size_t size;
+	bool quantised;
+	int capacity; // bins
+	float *spectrum;
+};
+
+static size_t get_frame_size(const struct wav_trace_frame *frame, bool quantised) {
+	size_t size = frame->bins*(quantised ? sizeof(uint16_t) : sizeof(float));
+	return sizeof(*frame) + ((size + 7) & ~(size_t) 7);
+}
+
+bool init_trace_recording(struct wav_state *state) {
+	const char *name = state->config.record_name;
+	if (name == NULL) return true;
+
+	struct wav_trace *trace = calloc(1, sizeof(*trace));
+	if (trace == NULL) {
+		fputs("Failed to allocate memory for trace\n", stderr);
+		return false;
+	}
+
+	// the spectrum can grow as outputs are added, but never past the transform
+	trace->quantised = state->config.record_quantised;
+	trace->capacity = get_dsp_capacity(&state->dsp);
+	trace->magnitudes = calloc(trace->capacity + 1, sizeof(*trace->magnitudes));
+	trace->file = fopen(name, "wb");
+	if (trace->magnitudes == NULL || trace->file == NULL) {
+		fprintf(stderr, "Failed to create trace '%s'\n", name);
+		if (trace->file != NULL) fclose(trace->file);
+		free(trace->magnitudes);
+		free(trace);
+		return false;
+	}
+
+	struct wav_trace_header header = {
+		.magic = WAV_TRACE_MAGIC,
+		.version = WAV_TRACE_VERSION,
+		.flags = trace->quantised ? WAV_TRACE_QUANTISED : 0,
+		.rate = state->dsp.rate,
+		.frequency_step = state->config.frequency_step
+	};
+	fwrite(&header, sizeof(header), 1, trace->file);
+
+	state->trace = trace;
+	return true;
+}
+
+void finish_trace_recording(struct wav_state *state) {
+	struct wav_trace *trace = state->trace;
+	if (trace == NULL) return;
+
+	if (ferror(trace->file) || fclose(trace->file) != 0) {
+		fprintf(stderr, "Failed to write trace '%s'\n", state->config.record_name);
+	}
+	free(trace->magnitudes);
+	free(trace);
+	state->trace = NULL;
+}
+
+void record_trace_frame(struct wav_state *state, const float *spectrum, int bins, uint32_t flags) {
+	struct wav_trace *trace = state->trace;
+	if (flags & WAV_TRACE_SILENT || bins < 0) bins = 0;
+	if (bins > trace->capacity) bins = trace->capacity;
+
+	struct wav_trace_frame frame = {
+		.timestamp = get_dsp_time(),
+		.bins = bins,
+		.flags = flags
+	};
+
+	const void *magnitudes = spectrum;
+	if (trace->quantised) {
+		float scale = 0;
+		for (int i = 0; i < bins; ++i) {
+			if (spectrum[i] > scale) scale = spectrum[i];
+		}
+		for (int i = 0; i < bins; ++i) {
+			trace->magnitudes[i] = scale > 0 ? lroundf(spectrum[i]/scale*UINT16_MAX) : 0;
+		}
+		frame.scale = scale;
+		magnitudes = trace->magnitudes;
+	}
+
+	static const uint64_t padding = 0;
+	size_t size = get_frame_size(&frame, trace->quantised) - sizeof(frame);
+	size_t magnitudes_size = bins*(trace->quantised ? sizeof(uint16_t) : sizeof(float));
+	fwrite(&frame, sizeof(frame), 1, trace->file);
+	if (bins > 0) fwrite(magnitudes, 1, magnitudes_size, trace->file);
+	fwrite(&padding, 1, size - magnitudes_size, trace->file);
+}
+
+static void wake_renderer(struct wav_state *state) {
+	static const uint64_t signal = 1;
+	write(state->audiofd, &signal, sizeof(signal));
+}
+
+// returns false if the replay was stopped before the deadline
+static bool wait_until(struct wav_replay *replay, int64_t deadline) {
+	struct timespec timeout = {
+		.tv_sec = deadline/1000000000,
+		.tv_nsec = deadline%1000000000
+	};
+
+	pthread_mutex_lock(&replay->lock);
+	while (!replay->stopping) {
+		if (pthread_cond_timedwait(&replay->stop, &replay->lock, &timeout) == ETIMEDOUT) break;
+	}
+	bool stopping = replay->stopping;
+	pthread_mutex_unlock(&replay->lock);
+	return !stopping;
+}
+
+// until a frame has been drawn since rendered was read, so that every frame of the trace is shown at least once
+static bool wait_for_frame(struct wav_replay *replay, unsigned long rendered) {
+	pthread_mutex_lock(&replay->lock);
+	while (!replay->stopping && replay->rendered == rendered) pthread_cond_wait(&replay->stop, &replay->lock);
+	bool stopping = replay->stopping;
+	pthread_mutex_unlock(&replay->lock);
+	return !stopping;
+}
+
+static unsigned long get_rendered(struct wav_replay *replay) {
+	pthread_mutex_lock(&replay->lock);
+	unsigned long rendered = replay->rendered;
+	pthread_mutex_unlock(&replay->lock);
+	return rendered;
+}
+
+static void *run_replay(void *data) {
+	struct wav_replay *replay = data;
+	struct wav_state *state = replay->state;
+	struct wav_source *source = &state->sources[0];
+
+	const unsigned char *cursor = replay->data + sizeof(struct wav_trace_header);
+	const unsigned char *end = replay->data + replay->size;
+	int64_t start = get_dsp_time(), first_timestamp = 0;
+	bool first = true;
+	while (end - cursor >= (ptrdiff_t) sizeof(struct wav_trace_frame)) {
+		const struct wav_trace_frame *frame = (const void *) cursor;
+		cursor += get_frame_size(frame, replay->quantised);
+
+		if (first) first_timestamp = frame->timestamp;
+		first = false;
+		if (!state->config.replay_fast && !wait_until(replay, start + frame->timestamp - first_timestamp)) break;
+
+		bool silent = frame->flags & WAV_TRACE_SILENT;
+		unsigned long rendered = get_rendered(replay);
+		if (!silent) {
+			if (replay->quantised) {
+				const uint16_t *magnitudes = (const void *) (frame + 1);
+				for (uint32_t i = 0; i < frame->bins; ++i) {
+					replay->spectrum[i] = magnitudes[i]*frame->scale/UINT16_MAX;
+				}
+			} else {
+				memcpy(replay->spectrum, frame + 1, frame->bins*sizeof(*replay->spectrum));
+			}
+			memset(replay->spectrum + frame->bins, 0, (replay->capacity - frame->bins)*sizeof(*replay->spectrum));
+			update_peaks(&source->peaks, replay->spectrum, get_dsp_time());
+		}
+
+		if (atomic_exchange_explicit(&source->silent, silent, memory_order_relaxed) && !silent) wake_renderer(state);
+
+		// the renderer stops drawing while the trace is silent, so only audible frames are waited for
+		if (state->config.replay_fast && !silent && !wait_for_frame(replay, rendered)) break;
+	}
+
+	// the whole trace has been rendered
+	atomic_store(&state->running, false);
+	wake_renderer(state);
+	return NULL;
+}
+
+// checks that every frame fits in the file, and finds the largest
+static bool scan_trace(struct wav_replay *replay) {
+	const unsigned char *cursor = replay->data + sizeof(struct wav_trace_header);
+	const unsigned char *end = replay->data + replay->size;
+	replay->capacity = 0;
+	while (cursor < end) {
+		const struct wav_trace_frame *frame = (const void *) cursor;
+		if (end - cursor < (ptrdiff_t) sizeof(*frame) ||
+				(size_t) (end - cursor) < get_frame_size(frame, replay->quantised)) {
+			return false;
+		}
+		if ((int) frame->bins > replay->capacity) replay->capacity = frame->bins;
+		cursor += get_frame_size(frame, replay->quantised);
+	}
+	return true;
+}
+
+bool start_replay(struct wav_state *state) {
+	const char *name = state->config.replay_name;
+	int fd = open(name, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to open trace '%s'\n", name);
+		return false;
+	}
+
+	struct stat stat;
+	if (fstat(fd, &stat) == -1 || (size_t) stat.st_size < sizeof(struct wav_trace_header)) {
+		fputs("Trace is too small\n", stderr);
+		close(fd);
+		return false;
+	}
+
+	void *data = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fputs("Failed to map trace to memory\n", stderr);
+		return false;
+	}
+
+	const struct wav_trace_header *header = data;
+	struct wav_replay *replay = calloc(1, sizeof(*replay));
+	if (replay == NULL) {
+		fputs("Failed to allocate memory for replay\n", stderr);
+		munmap(data, stat.st_size);
+		return false;
+	}
+	replay->state = state;
+	replay->data = data;
+	replay->size = stat.st_size;
+	replay->quantised = header->flags & WAV_TRACE_QUANTISED;
+
+	if (header->magic != WAV_TRACE_MAGIC || header->version != WAV_TRACE_VERSION || !scan_trace(replay)) {
+		fputs("Trace has an unknown layout or is truncated\n", stderr);
+		munmap(data, stat.st_size);
+		free(replay);
+		return false;
+	}
+	if ((int) header->frequency_step != state->config.frequency_step) {
+		fprintf(stderr, "Warning: trace was recorded with a frequency step of %u Hz\n", header->frequency_step);
+	}
+
+	// a trace is of a single source
+	struct wav_source *source = &state->sources[0];
+	source->state = state;
+	atomic_init(&source->silent, true);
+	state->source_count = 1;
+	state->spectrum_size = replay->capacity;
+	replay->spectrum = calloc(replay->capacity + 1, sizeof(*replay->spectrum));
+	if (replay->spectrum == NULL || !init_peaks(&source->peaks, replay->capacity, state->config.diminish_rate,
+			state->config.interpolated)) {
+		fputs("Failed to initialise replay\n", stderr);
+		free(replay->spectrum);
+		munmap(data, stat.st_size);
+		free(replay);
+		return false;
+	}
+
+	pthread_condattr_t attributes;
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&replay->stop, &attributes);
+	pthread_condattr_destroy(&attributes);
+	pthread_mutex_init(&replay->lock, NULL);
+
+	state->audiofd = eventfd(0, 0);
+	state->replay = replay;
+	if (pthread_create(&replay->thread, NULL, run_replay, replay) != 0) {
+		fputs("Failed to start replay thread\n", stderr);
+		state->replay = NULL;
+		close(state->audiofd);
+		pthread_mutex_destroy(&replay->lock);
+		pthread_cond_destroy(&replay->stop);
+		finish_peaks(&source->peaks);
+		free(replay->spectrum);
+		munmap(data, stat.st_size);
+		free(replay);
+		return false;
+	}
+
+	return true;
+}
+
+void count_replay_frame(struct wav_state *state) {
+	struct wav_replay *replay = state->replay;
+	if (replay == NULL || !state->config.replay_fast) return;
+
+	pthread_mutex_lock(&replay->lock);
+	++replay->rendered;
+	pthread_cond_signal(&replay->stop);
+	pthread_mutex_unlock(&replay->lock);
+}
+
+void stop_replay(struct wav_state *state) {
+	struct wav_replay *replay = state->replay;
+
+	pthread_mutex_lock(&replay->lock);
+	replay->stopping = true;
+	pthread_cond_signal(&replay->stop);
+	pthread_mutex_unlock(&replay->lock);
+	pthread_join(replay->thread, NULL);
+
+	close(state->audiofd);
+	pthread_mutex_destroy(&replay->lock);
+	pthread_cond_destroy(&replay->stop);
+	finish_peaks(&state->sources[0].peaks);
+	free(replay->spectrum);
+	munmap((void *) replay->data, replay->size);
+	free(replay);
+	state->replay = NULL;
+}
@@ -0,0 +1,99 @@
+#define _XOPEN_SOURCE 500
+
+#include "buffer.h"
+#include "output.h"
+#include "probes.h"
+#include "waterfall.h"
+#include "wav.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+struct wav_waterfall *create_waterfall(struct wav_output *output) {
+	struct wav_waterfall *waterfall = calloc(1, sizeof(*waterfall));
+	if (waterfall == NULL) {
+		fputs("Failed to allocate memory for waterfall\n", stderr);
+		return NULL;
+	}
+
+	waterfall->stride = output->pixel_format->bytes_per_pixel*output->width;
+	waterfall->height = output->height;
+	waterfall->lines = get_waterfall_lines(output->height);
+	waterfall->size = (size_t) waterfall->stride*waterfall->lines;
+	waterfall->views = calloc(waterfall->lines - waterfall->height + 1, sizeof(*waterfall->views));
+	if (waterfall->views == NULL) {
+		fputs("Failed to allocate memory for waterfall\n", stderr);
+		free(waterfall);
+		return NULL;
+	}
+
+	// the pool file starts out zeroed, so every line is transparent until it is drawn
+	char path[64];
+	int fd = create_pool_file(waterfall->size, path);
+	if (fd < 0) {
+		free(waterfall->views);
+		free(waterfall);
+		return NULL;
+	}
+	waterfall->data = mmap(NULL, waterfall->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (waterfall->data == MAP_FAILED) {
+		fputs("Failed to map pool file to memory\n", stderr);
+		close(fd);
+		unlink(path);
+		free(waterfall->views);
+		free(waterfall);
+		return NULL;
+	}
+	waterfall->pool = wl_shm_create_pool(output->state->shm, fd, waterfall->size);
+	close(fd);
+	unlink(path);
+
+	return waterfall;
+}
+
+void destroy_waterfall(struct wav_waterfall *waterfall) {
+	for (int i = 0; i <= waterfall->lines - waterfall->height; ++i) {
+		if (waterfall->views[i] != NULL) wl_buffer_destroy(waterfall->views[i]);
+	}
+
+	wl_shm_pool_destroy(waterfall->pool);
+	munmap(waterfall->data, waterfall->size);
+	free(waterfall->views);
+	free(waterfall);
+}
+
+void *scroll_waterfall(struct wav_waterfall *waterfall) {
+	// once the view reaches the end of the pool, all but its oldest line are copied back to the start,
+	// which spread over the frames it took to get there costs about a line per frame
+	if (waterfall->offset + waterfall->height == waterfall->lines) {
+		memcpy(waterfall->data, waterfall->data + (size_t) (waterfall->offset + 1)*waterfall->stride,
+				(size_t) (waterfall->height - 1)*waterfall->stride);
+		waterfall->offset = -1;
+	}
+
+	++waterfall->offset;
+	return waterfall->data + (size_t) (waterfall->offset + waterfall->height - 1)*waterfall->stride;
+}
+
+// a view is attached again only once the whole pool has scrolled past, long after the compositor let go of it
+static void release_view(void *data, struct wl_buffer *wl_buffer) {
+	WAV_PROBE1(buffer_release, wl_buffer);
+}
+
+struct wl_buffer *get_waterfall_view(struct wav_waterfall *waterfall, struct wav_output *output) {
+	struct wl_buffer **view = &waterfall->views[waterfall->offset];
+	if (*view == NULL) {
+		*view = wl_shm_pool_create_buffer(waterfall->pool, waterfall->offset*waterfall->stride,
+				output->width, waterfall->height, waterfall->stride, output->pixel_format->shm_format);
+		static const struct wl_buffer_listener view_listener = {
+			.release = release_view
+		};
+		wl_buffer_add_listener(*view, &view_listener, waterfall);
+	}
+	return *view;
+}
@@ -0,0 +1,106 @@
+#include "waveform.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool init_waveform(struct wav_waveform *waveform, size_t window) {
+	waveform->window = window;
+	waveform->capacity = 1;
+	waveform->levels = 1;
+	while (waveform->capacity < 2*window) {
+		waveform->capacity <<= 1;
+		++waveform->levels;
+	}
+	if (waveform->levels > MAX_WAVEFORM_LEVELS) waveform->levels = MAX_WAVEFORM_LEVELS;
+	atomic_init(&waveform->count, 0);
+
+	// each level is half the size of the one below, so all of them above the samples take up
+	// no more than the samples again, for the minima and for the maxima
+	waveform->samples = calloc(3*waveform->capacity, sizeof(*waveform->samples));
+	if (waveform->samples == NULL) {
+		fputs("Failed to allocate memory for waveform\n", stderr);
+		return false;
+	}
+
+	waveform->min[0] = waveform->max[0] = waveform->samples;
+	float *next = waveform->samples + waveform->capacity;
+	for (int level = 1; level < waveform->levels; ++level) {
+		size_t size = waveform->capacity >> level;
+		waveform->min[level] = next;
+		waveform->max[level] = next + size;
+		next += 2*size;
+	}
+
+	return true;
+}
+
+void finish_waveform(struct wav_waveform *waveform) {
+	free(waveform->samples);
+	waveform->samples = NULL;
+}
+
+void reset_waveform(struct wav_waveform *waveform) {
+	memset(waveform->samples, 0, 3*waveform->capacity*sizeof(*waveform->samples));
+	atomic_store_explicit(&waveform->count, 0, memory_order_release);
+}
+
+// pairs of children into their parents, written without branches so that the compiler vectorises it
+static void reduce_nodes(float *restrict min, float *restrict max,
+		const float *restrict child_min, const float *restrict child_max, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		float a = child_min[2*i], b = child_min[2*i + 1];
+		min[i] = a < b ? a : b;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		float a = child_max[2*i], b = child_max[2*i + 1];
+		max[i] = a > b ? a : b;
+	}
+}
+
+// nodes first to last, split where the ring wraps around
+static void update_level(struct wav_waveform *waveform, int level, uint64_t first, uint64_t last) {
+	size_t size = waveform->capacity >> level;
+	while (first < last) {
+		size_t i = get_waveform_node(waveform, level, first);
+		size_t count = last - first < size - i ? last - first : size - i;
+		reduce_nodes(waveform->min[level] + i, waveform->max[level] + i,
+				waveform->min[level - 1] + 2*i, waveform->max[level - 1] + 2*i, count);
+		first += count;
+	}
+}
+
+void push_waveform_samples(struct wav_waveform *waveform, const float *samples, size_t count) {
+	uint64_t start = atomic_load_explicit(&waveform->count, memory_order_relaxed);
+	if (count > waveform->capacity) {
+		samples += count - waveform->capacity;
+		start += count - waveform->capacity;
+		count = waveform->capacity;
+	}
+	uint64_t end = start + count;
+
+	size_t i = get_waveform_node(waveform, 0, start);
+	size_t head = count < waveform->capacity - i ? count : waveform->capacity - i;
+	memcpy(waveform->samples + i, samples, head*sizeof(*samples));
+	memcpy(waveform->samples, samples + head, (count - head)*sizeof(*samples));
+
+	// a node is complete once its last sample is in, and the levels above can only complete nodes
+	// once the ones below have
+	for (int level = 1; level < waveform->levels; ++level) {
+		uint64_t first = start >> level, last = end >> level;
+		if (first == last) break;
+		update_level(waveform, level, first, last);
+	}
+
+	atomic_store_explicit(&waveform->count, end, memory_order_release);
+}
+
+int get_waveform_level(const struct wav_waveform *waveform, int columns) {
+	int level = 0;
+	while (level + 1 < waveform->levels && ((size_t) columns << (level + 1)) <= waveform->window) ++level;
+	return level;
+}
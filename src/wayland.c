@@ -1,3 +1,6 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "buffer.h"
 // #include "config.h"
 #include "output.h"
 // #include "string-list.h"
@@ -11,10 +14,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
 #include <wayland-client.h>
 
-static void noop() {
-	// intentionally left blank
+static void handle_shm_format(void *data, struct wl_shm *shm, uint32_t format) {
+	struct wav_state *state = data;
+	const struct wav_pixel_format *pixel_format = get_pixel_format(format);
+	if (pixel_format == NULL || state->pixel_format_settled) return;
+
+	const char *requested = state->config.pixel_format;
+	if (requested != NULL && strcmp(pixel_format->name, requested) == 0) state->pixel_format = pixel_format;
 }
 
 static void handle_registry(void *data, struct wl_registry *registry,
@@ -27,11 +38,32 @@ static void handle_registry(void *data, struct wl_registry *registry,
 		state->layer_shell = wl_registry_bind(registry, name, &zwlr_layer_shell_v1_interface, 1);
 	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
 		state->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+		static const struct wl_shm_listener shm_listener = {
+			.format = handle_shm_format
+		};
+		wl_shm_add_listener(state->shm, &shm_listener, state);
+	} else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+		state->viewporter = wl_registry_bind(registry, name, &wp_viewporter_interface, 1);
+	} else if (strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0) {
+		state->fractional_scale_manager = wl_registry_bind(registry, name,
+				&wp_fractional_scale_manager_v1_interface, 1);
 	} else if (strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
 		state->output_manager = wl_registry_bind(registry, name, &zxdg_output_manager_v1_interface, 2);
 	} else if (strcmp(interface, wl_output_interface.name) == 0) {
 		struct wl_output *output = wl_registry_bind(registry, name, &wl_output_interface, 3);
-		create_output(state, output);
+		create_output(state, output, name);
+	}
+}
+
+static void handle_registry_remove(void *data, struct wl_registry *registry, uint32_t name) {
+	struct wav_state *state = data;
+
+	struct wav_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (output->name == name) {
+			destroy_output(output);
+			return;
+		}
 	}
 }
 
@@ -44,10 +76,24 @@ bool init_wayland(struct wav_state *state) {
 
 	wl_list_init(&state->outputs);
 
+	state->visibilityfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (state->visibilityfd == -1) {
+		fputs("Failed to create visibility timer\n", stderr);
+		return false;
+	}
+
+	// always supported, only replaced by a requested format once the compositor advertises it
+	state->pixel_format = get_pixel_format(WL_SHM_FORMAT_ARGB8888);
+	if (state->config.pixel_format != NULL &&
+			get_pixel_format_by_name(state->config.pixel_format) == NULL) {
+		fprintf(stderr, "Unknown pixel format '%s'\n", state->config.pixel_format);
+		return false;
+	}
+
 	state->registry = wl_display_get_registry(state->display);
 	static struct wl_registry_listener registry_listener = {
 		.global = handle_registry,
-		.global_remove = noop
+		.global_remove = handle_registry_remove
 	};
 	wl_registry_add_listener(state->registry, &registry_listener, state);
 	wl_display_roundtrip(state->display);
@@ -56,16 +102,27 @@ bool init_wayland(struct wav_state *state) {
 		return false;
 	}
 
-	if (wl_list_length(&state->outputs) == 0) {
-		// do not terminate in case outputs are later added
-		fputs("Warning: no outputs detected\n", stderr);
-		return true;
+	if (state->config.render_scale != 1 && state->viewporter == NULL) {
+		fputs("Warning: compositor does not support viewporter, ignoring render scale\n", stderr);
 	}
 
-	// second roundtrip to get output properties
+	// second roundtrip to get shm formats and output properties, outputs may be configured before the formats
+	// arrive but only get their buffers once every output can be given the same one
+	bool outputs_detected = wl_list_length(&state->outputs) > 0;
 	wl_display_roundtrip(state->display);
+	state->pixel_format_settled = true;
+	create_output_buffers(state);
 
-	if (wl_list_length(&state->outputs) == 0) {
+	if (state->config.pixel_format != NULL &&
+			strcmp(state->pixel_format->name, state->config.pixel_format) != 0) {
+		fprintf(stderr, "Warning: pixel format '%s' is not supported by the compositor\n",
+				state->config.pixel_format);
+	}
+
+	if (!outputs_detected) {
+		// do not terminate in case outputs are later added
+		fputs("Warning: no outputs detected\n", stderr);
+	} else if (wl_list_length(&state->outputs) == 0) {
 		// do not terminate in case the correct output is later added
 		fputs("Warning: no outputs found matching specified names\n", stderr);
 	}
@@ -81,8 +138,13 @@ void finish_wayland(struct wav_state *state) {
 
 	wl_shm_destroy(state->shm);
 	if (state->output_manager != NULL) zxdg_output_manager_v1_destroy(state->output_manager);
+	if (state->fractional_scale_manager != NULL) {
+		wp_fractional_scale_manager_v1_destroy(state->fractional_scale_manager);
+	}
+	if (state->viewporter != NULL) wp_viewporter_destroy(state->viewporter);
 	zwlr_layer_shell_v1_destroy(state->layer_shell);
 	wl_compositor_destroy(state->compositor);
 	wl_registry_destroy(state->registry);
 	wl_display_disconnect(state->display);
+	close(state->visibilityfd);
 }